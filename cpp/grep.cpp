@@ -0,0 +1,82 @@
+#include "grep.h"
+
+#include <cstring>
+
+namespace
+{
+const char* grep_outputs = "[:both :lines :numbers]";
+
+Janet
+grep_result(const GrepOptions& options, int64_t number, const char* line, size_t length)
+{
+  switch (options.output)
+  {
+  case GrepOutput::Lines:
+    return janet_stringv((const uint8_t*)line, (int32_t)length);
+  case GrepOutput::Numbers:
+    return janet_wrap_number((double)number);
+  default:
+    break;
+  }
+  Janet* result = janet_tuple_begin(2);
+  result[0]     = janet_wrap_number((double)number);
+  result[1]     = janet_stringv((const uint8_t*)line, (int32_t)length);
+  return janet_wrap_tuple(janet_tuple_end(result));
+}
+}
+
+GrepOptions
+get_grep_options(const Janet* argv, int32_t argc, int32_t first)
+{
+  GrepOptions options;
+  if (argc > first)
+    options.invert = janet_truthy(argv[first]);
+  if (argc > first + 1 && !janet_checktype(argv[first + 1], JANET_NIL))
+  {
+    options.max_count = janet_getinteger64(argv, first + 1);
+    if (options.max_count < 0)
+      janet_panic("max-count must be non-negative");
+  }
+  if (argc > first + 2 && !janet_checktype(argv[first + 2], JANET_NIL))
+  {
+    auto output = janet_getkeyword(argv, first + 2);
+    if (output == janet_ckeyword("both"))
+      options.output = GrepOutput::Both;
+    else if (output == janet_ckeyword("lines"))
+      options.output = GrepOutput::Lines;
+    else if (output == janet_ckeyword("numbers"))
+      options.output = GrepOutput::Numbers;
+    else
+      janet_panicf("output must be one of %s", grep_outputs);
+  }
+  return options;
+}
+
+int
+grep_lines(const char* text, size_t length, const GrepOptions& options, const LineMatcher& matcher,
+           JanetArray* array)
+{
+  const char* end    = text + length;
+  const char* line   = text;
+  int64_t     number = 0;
+  int64_t     found  = 0;
+
+  // memchr finds each newline a word or vector at a time
+  while (line < end && found != options.max_count)
+  {
+    const char* newline = (const char*)memchr(line, '\n', end - line);
+    const char* eol     = newline ? newline : end;
+    ++number;
+
+    int rc = matcher(line, eol - line);
+    if (rc < 0)
+      return rc;
+    if ((rc > 0) != options.invert)
+    {
+      janet_array_push(array, grep_result(options, number, line, eol - line));
+      ++found;
+    }
+    line = eol + 1;
+  }
+  return 0;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <janet.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// What jre/grep-lines returns for each selected line.
+enum class GrepOutput
+{
+  Both,    // [line-number line] tuples
+  Lines,   // line strings
+  Numbers, // 1-based line numbers
+};
+
+struct GrepOptions
+{
+  bool       invert    = false; // select lines that do not match
+  int64_t    max_count = -1;    // stop after this many selected lines, -1 for no limit
+  GrepOutput output    = GrepOutput::Both;
+};
+
+// Parse the invert, max-count and output arguments starting at argv[first].
+// Missing or nil arguments keep the defaults.
+GrepOptions get_grep_options(const Janet* argv, int32_t argc, int32_t first);
+
+// Tests one line, without its newline. Returns > 0 for a match, 0 for no
+// match or a negative engine error code, which stops the scan.
+using LineMatcher = std::function<int(const char* line, size_t length)>;
+
+// Walk the lines of text, split on '\n', and collect the selected ones into
+// array. A final line without a newline is included. Returns 0, or the
+// first negative code returned by matcher.
+int grep_lines(const char* text, size_t length, const GrepOptions& options, const LineMatcher& matcher,
+               JanetArray* array);
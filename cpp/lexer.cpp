@@ -0,0 +1,205 @@
+#include "lexer.h"
+
+#include <cstdlib>
+#include <sstream>
+
+namespace
+{
+std::string
+combine_rules(const std::vector<std::string>& patterns)
+{
+  std::ostringstream os;
+  for (size_t i = 0; i < patterns.size(); ++i)
+  {
+    if (i > 0)
+      os << "|";
+    os << "(*MARK:" << i << ")(?:" << patterns[i] << ")";
+  }
+  return os.str();
+}
+
+// Compile each rule alone first, so an unbalanced rule cannot pair up with
+// its neighbours in the alternation, and errors name the rule.
+bool
+check_rules(const std::vector<std::string>& patterns, JanetTuple kinds, const std::vector<Janet>& flags,
+            std::string& error)
+{
+  std::vector<Janet> check_flags = flags;
+  check_flags.push_back(janet_ckeywordv("jit"));
+  check_flags.push_back(janet_ckeywordv("off"));
+  for (size_t i = 0; i < patterns.size(); ++i)
+  {
+    JanetPCRE2Regex* rule = new_abstract_pcre2_regex(patterns[i].c_str(), check_flags.data(), 0,
+                                                     (int32_t)check_flags.size());
+    bool ok = rule->re != nullptr;
+    if (!ok)
+    {
+      JanetBuffer* kind = janet_buffer(0);
+      janet_description_b(kind, kinds[i]);
+      std::ostringstream os;
+      os << "lexer rule " << i << " (" << std::string((const char*)kind->data, kind->count)
+         << "): " << *rule->pattern;
+      error = os.str();
+    }
+    regex_gc(rule, 0);
+    if (!ok)
+      return false;
+  }
+  return true;
+}
+}
+
+int
+lexer_gc(void* data, size_t len)
+{
+  (void)len;
+  if (data)
+  {
+    JanetLexer* lexer = (JanetLexer*)data;
+    if (lexer->match_data)
+    {
+      pcre2_match_data_free(lexer->match_data);
+      lexer->match_data = nullptr;
+    }
+    if (lexer->error)
+    {
+      delete (lexer->error);
+      lexer->error = nullptr;
+    }
+  }
+  return 0;
+}
+
+int
+lexer_gcmark(void* data, size_t len)
+{
+  (void)len;
+  JanetLexer* lexer = (JanetLexer*)data;
+  if (lexer->regex)
+    janet_mark(janet_wrap_abstract(lexer->regex));
+  if (lexer->kinds)
+    janet_mark(janet_wrap_tuple(lexer->kinds));
+  return 0;
+}
+
+void
+lexer_tostring(void* data, JanetBuffer* buffer)
+{
+  if (data)
+  {
+    JanetLexer* lexer = (JanetLexer*)data;
+    if (!lexer->kinds)
+    {
+      janet_buffer_push_cstring(buffer, "no rules");
+      return;
+    }
+    janet_buffer_push_cstring(buffer, "rules: (");
+    for (int32_t i = 0; i < janet_tuple_length(lexer->kinds); ++i)
+    {
+      if (i > 0)
+        janet_buffer_push_cstring(buffer, " ");
+      janet_description_b(buffer, lexer->kinds[i]);
+    }
+    janet_buffer_push_cstring(buffer, ")");
+  }
+}
+
+JanetAbstractType lexer_type = {};
+
+void
+initialize_lexer_type()
+{
+  if (!lexer_type.name)
+  {
+    lexer_type.name     = "jre-lexer";
+    lexer_type.gc       = lexer_gc;
+    lexer_type.gcmark   = lexer_gcmark;
+    lexer_type.tostring = lexer_tostring;
+  }
+}
+
+JanetLexer*
+new_abstract_lexer(const std::vector<std::string>& patterns, JanetTuple kinds, const Janet* flags,
+                   int32_t flag_count)
+{
+  initialize_lexer_type();
+  JanetLexer* lexer = (JanetLexer*)janet_abstract(&lexer_type, sizeof(JanetLexer));
+  lexer->regex      = nullptr;
+  lexer->kinds      = kinds;
+  lexer->match_data = nullptr;
+  lexer->error      = nullptr;
+
+  // tokens must start exactly at the current position
+  std::vector<Janet> all_flags(flags, flags + flag_count);
+  all_flags.push_back(janet_ckeywordv("anchored"));
+
+  std::string error;
+  if (patterns.empty())
+  {
+    lexer->error = new std::string("lexer needs at least one rule");
+    return lexer;
+  }
+  if (!check_rules(patterns, kinds, all_flags, error))
+  {
+    lexer->error = new std::string(error);
+    return lexer;
+  }
+
+  auto  combined = combine_rules(patterns);
+  auto* regex    = new_abstract_pcre2_regex(combined.c_str(), all_flags.data(), 0, (int32_t)all_flags.size());
+  if (!regex->re)
+  {
+    lexer->error = new std::string(*regex->pattern);
+    return lexer;
+  }
+  if (regex->dfa)
+  {
+    // pcre2_dfa_match does not record marks
+    lexer->error = new std::string("lexer rules cannot use :dfa or :shortest");
+    return lexer;
+  }
+  lexer->regex      = regex;
+  lexer->match_data = pcre2_match_data_create_from_pattern(regex->re, pcre2_pool_context());
+  regex_account(regex);
+  janet_gcpressure(regex->memory);
+  return lexer;
+}
+
+Janet
+lexer_next(const JanetLexer* lexer, const char* subject, size_t length, size_t pos, std::string& error)
+{
+  if (pos >= length)
+    return janet_wrap_nil();
+
+  // a rule that could only match empty gives way to the next alternative
+  int rc = pcre2_exec(lexer->regex, subject, length, pos, PCRE2_NOTEMPTY_ATSTART, lexer->match_data);
+  if (rc == PCRE2_ERROR_NOMATCH)
+  {
+    error = "no lexer rule matches at position " + std::to_string(pos);
+    return janet_wrap_nil();
+  }
+  if (rc < 0)
+  {
+    PCRE2_UCHAR buffer[256];
+    pcre2_get_error_message(rc, buffer, sizeof(buffer));
+    error = (const char*)buffer;
+    return janet_wrap_nil();
+  }
+
+  // a rule with its own (*MARK) would hide the rule number
+  PCRE2_SPTR mark     = pcre2_get_mark(lexer->match_data);
+  char*      mark_end = nullptr;
+  size_t     rule     = mark ? strtoul((const char*)mark, &mark_end, 10) : 0;
+  size_t     end      = pcre2_get_ovector_pointer(lexer->match_data)[1];
+  if (!mark || *mark_end != '\0' || rule >= (size_t)janet_tuple_length(lexer->kinds))
+  {
+    error = "lexer rules cannot use their own (*MARK) names";
+    return janet_wrap_nil();
+  }
+
+  Janet* token = janet_tuple_begin(3);
+  token[0]     = lexer->kinds[rule];
+  token[1]     = janet_wrap_number((double)pos);
+  token[2]     = janet_wrap_number((double)end);
+  return janet_wrap_tuple(janet_tuple_end(token));
+}
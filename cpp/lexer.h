@@ -0,0 +1,39 @@
+#pragma once
+
+#include <janet.h>
+
+#include <string>
+#include <vector>
+
+#include "wrap_pcre2.h"
+
+// A tokenizer built from an ordered list of [kind pattern] rules. The rules
+// are compiled into one anchored PCRE2 alternation,
+//
+//   (*MARK:0)(?:rule0)|(*MARK:1)(?:rule1)|...
+//
+// so a single match at the current position picks the first rule that
+// matches there, and the mark names which rule it was.
+struct JanetLexer
+{
+  JanetGCObject     gc;
+  JanetPCRE2Regex*  regex      = nullptr; // the combined pattern
+  JanetTuple        kinds      = nullptr; // token kind for each rule
+  pcre2_match_data* match_data = nullptr; // reused for every token
+  std::string*      error      = nullptr;
+};
+
+extern JanetAbstractType lexer_type;
+
+// Compile the rules. `flags` are PCRE2 compile flags applied to every rule.
+// On failure `regex` is null and `error` holds the message.
+JanetLexer* new_abstract_lexer(const std::vector<std::string>& patterns, JanetTuple kinds, const Janet* flags,
+                               int32_t flag_count);
+
+int  lexer_gc(void* data, size_t len);
+int  lexer_gcmark(void* data, size_t len);
+void lexer_tostring(void* data, JanetBuffer* buffer);
+
+// Match one token at `pos`, returning a [kind begin end] tuple, or nil at
+// the end of the subject. On error returns nil with the message in error.
+Janet lexer_next(const JanetLexer* lexer, const char* subject, size_t length, size_t pos, std::string& error);
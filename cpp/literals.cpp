@@ -0,0 +1,275 @@
+#include "literals.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+// states with more edges than this are binary searched
+const uint32_t linear_edges = 8;
+
+// most entries in the rows of resolved transitions, 256 KB
+const size_t row_budget = 1 << 16;
+
+const uint32_t no_edge = UINT32_MAX;
+
+inline uint8_t
+lower(uint8_t c)
+{
+  return c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+}
+}
+
+void
+LiteralSet::build(const std::vector<std::string>& literals, bool ignorecase)
+{
+  m_literals = 0;
+  for (int b = 0; b < 256; ++b)
+    m_fold[b] = ignorecase ? lower((uint8_t)b) : (uint8_t)b;
+
+  // an insertion trie first, laid out breadth first below
+  struct Node
+  {
+    std::vector<std::pair<uint8_t, uint32_t>> children;
+    uint32_t                                  length = 0; // of the literal ending here
+  };
+  std::vector<Node> trie(1);
+  for (auto&& literal : literals)
+  {
+    if (literal.empty())
+      continue;
+    ++m_literals;
+    uint32_t node = 0;
+    for (unsigned char c : literal)
+    {
+      uint8_t byte  = m_fold[c];
+      auto&   edges = trie[node].children;
+      auto    edge  = std::find_if(edges.begin(), edges.end(), [&](const std::pair<uint8_t, uint32_t>& e) {
+        return e.first == byte;
+      });
+      if (edge != edges.end())
+      {
+        node = edge->second;
+        continue;
+      }
+      uint32_t child = (uint32_t)trie.size();
+      trie[node].children.emplace_back(byte, child);
+      trie.emplace_back();
+      node = child;
+    }
+    trie[node].length = (uint32_t)literal.size();
+  }
+
+  std::vector<uint32_t> order(1, 0);
+  std::vector<uint32_t> id(trie.size());
+  order.reserve(trie.size());
+  for (size_t i = 0; i < order.size(); ++i)
+  {
+    id[order[i]] = (uint32_t)i;
+    auto& children = trie[order[i]].children;
+    std::sort(children.begin(), children.end());
+    for (auto&& child : children)
+      order.push_back(child.second);
+  }
+
+  m_states.assign(trie.size(), State());
+  m_bytes.clear();
+  m_targets.clear();
+  m_bytes.reserve(trie.size() - 1);
+  m_targets.reserve(trie.size() - 1);
+  for (size_t i = 0; i < order.size(); ++i)
+  {
+    const Node& node  = trie[order[i]];
+    State&      state = m_states[i];
+    state.transitions = (uint32_t)m_bytes.size();
+    state.count       = (uint32_t)node.children.size();
+    state.match       = node.length;
+    for (auto&& child : node.children)
+    {
+      m_bytes.push_back(child.first);
+      m_targets.push_back(id[child.second]);
+      m_states[id[child.second]].depth = state.depth + 1;
+    }
+  }
+
+  // the first bytes, in either case with ignorecase
+  m_first.reset();
+  for (uint32_t t = 0; t < m_states[0].count; ++t)
+  {
+    for (int b = 0; b < 256; ++b)
+    {
+      if (m_fold[b] == m_bytes[t])
+        m_first[b] = true;
+    }
+  }
+  m_start_count = m_first.count() <= 4 ? (int)m_first.count() : 0;
+  for (int b = 0, n = 0; b < 256 && n < m_start_count; ++b)
+  {
+    if (m_first[b])
+      m_starts[n++] = (uint8_t)b;
+  }
+
+  // failure links in breadth-first order, so every shallower state has its
+  // link when a state's is found; a state without a literal of its own
+  // reports the longest one its suffixes end
+  m_rows.clear();
+  m_row_states = 0;
+  for (uint32_t i = 0; i < m_states.size(); ++i)
+  {
+    const State& state = m_states[i];
+    for (uint32_t t = state.transitions; t < state.transitions + state.count; ++t)
+    {
+      State& child = m_states[m_targets[t]];
+      child.fail   = i == 0 ? 0 : next(state.fail, m_bytes[t]);
+      if (!child.match)
+        child.match = m_states[child.fail].match;
+    }
+  }
+
+  // a class for each byte the literals use, the rest share class 0
+  std::fill(std::begin(m_class), std::end(m_class), 0);
+  m_classes = 1;
+  for (uint8_t byte : m_bytes)
+  {
+    if (!m_class[byte])
+      m_class[byte] = (uint16_t)m_classes++;
+  }
+
+  // rows for as many of the shallowest states as fit; a missing edge leads
+  // where the failure state's row does, which is filled in already
+  uint32_t rows = (uint32_t)std::max<size_t>(1, std::min(m_states.size(), row_budget / m_classes));
+  m_rows.assign((size_t)rows * m_classes, 0);
+  for (uint32_t i = 0; i < rows; ++i)
+  {
+    const State& state = m_states[i];
+    uint32_t*    row   = &m_rows[(size_t)i * m_classes];
+    if (i > 0)
+      std::copy_n(&m_rows[(size_t)state.fail * m_classes], m_classes, row);
+    for (uint32_t t = state.transitions; t < state.transitions + state.count; ++t)
+      row[m_class[m_bytes[t]]] = m_targets[t];
+  }
+  m_row_states = rows;
+}
+
+size_t
+LiteralSet::memory() const
+{
+  return sizeof(LiteralSet) + m_states.capacity() * sizeof(State) + m_bytes.capacity() +
+         (m_targets.capacity() + m_rows.capacity()) * sizeof(uint32_t);
+}
+
+uint32_t
+LiteralSet::edge(uint32_t state, uint8_t byte) const
+{
+  const State&   s     = m_states[state];
+  const uint8_t* bytes = m_bytes.data() + s.transitions;
+  if (s.count <= linear_edges)
+  {
+    for (uint32_t t = 0; t < s.count; ++t)
+    {
+      if (bytes[t] == byte)
+        return m_targets[s.transitions + t];
+    }
+    return no_edge;
+  }
+  const uint8_t* found = std::lower_bound(bytes, bytes + s.count, byte);
+  if (found != bytes + s.count && *found == byte)
+    return m_targets[s.transitions + (found - bytes)];
+  return no_edge;
+}
+
+// byte is folded already
+uint32_t
+LiteralSet::next(uint32_t state, uint8_t byte) const
+{
+  for (;;)
+  {
+    if (state < m_row_states)
+      return m_rows[(size_t)state * m_classes + m_class[byte]];
+    uint32_t target = edge(state, byte);
+    if (target != no_edge)
+      return target;
+    if (state == 0)
+      return 0;
+    state = m_states[state].fail;
+  }
+}
+
+size_t
+LiteralSet::skip(const uint8_t* subject, size_t length, size_t pos) const
+{
+  if (m_start_count == 1)
+  {
+    const void* found = memchr(subject + pos, m_starts[0], length - pos);
+    return found ? (const uint8_t*)found - subject : length;
+  }
+
+#if defined(__SSE2__)
+  if (m_start_count > 1)
+  {
+    // compare 16 bytes against each start byte, repeating the last to fill
+    // four vectors
+    __m128i v[4];
+    for (int k = 0; k < 4; ++k)
+      v[k] = _mm_set1_epi8((char)m_starts[std::min(k, m_start_count - 1)]);
+    for (; pos + 16 <= length; pos += 16)
+    {
+      __m128i  block = _mm_loadu_si128((const __m128i*)(subject + pos));
+      __m128i  hits  = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, v[0]), _mm_cmpeq_epi8(block, v[1])),
+                                    _mm_or_si128(_mm_cmpeq_epi8(block, v[2]), _mm_cmpeq_epi8(block, v[3])));
+      unsigned mask  = (unsigned)_mm_movemask_epi8(hits);
+      if (mask)
+        return pos + (unsigned)__builtin_ctz(mask);
+    }
+  }
+#endif
+
+  while (pos < length && !m_first[subject[pos]])
+    ++pos;
+  return pos;
+}
+
+bool
+LiteralSet::search(const char* subject, size_t length, size_t start, size_t& begin, size_t& end) const
+{
+  if (start > length || m_literals == 0)
+    return false;
+
+  const uint8_t* text  = (const uint8_t*)subject;
+  uint32_t       state = 0;
+  size_t         best  = SIZE_MAX;
+  size_t         last  = 0;
+  for (size_t i = start; i < length; ++i)
+  {
+    // at the root nothing is in progress, so jump to where one can start
+    if (state == 0)
+    {
+      i = skip(text, length, i);
+      if (i == length)
+        break;
+    }
+    state          = next(state, m_fold[text[i]]);
+    const State& s = m_states[state];
+    // a literal ending here starts no later than the best so far, so it
+    // either starts earlier or is a longer one with the same start
+    if (s.match && i + 1 - s.match <= best)
+    {
+      best = i + 1 - s.match;
+      last = i + 1;
+    }
+    // the literals still in progress all start after best
+    if (best != SIZE_MAX && i + 1 - s.depth > best)
+      break;
+  }
+  if (best == SIZE_MAX)
+    return false;
+  begin = best;
+  end   = last;
+  return true;
+}
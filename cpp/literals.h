@@ -0,0 +1,62 @@
+#pragma once
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// An Aho-Corasick automaton over a set of literal strings, for dictionaries
+// too large to match well as one alternation. States are numbered breadth
+// first, so the shallow states that most bytes visit come first. Those get
+// full rows of resolved transitions over the byte classes the literals use,
+// within a budget that keeps the table in cache; deeper states keep their
+// trie edges in one flat, sorted array and fall back along failure links to
+// a row. While the search is at the root it skips to the next byte that can
+// start a literal, with a vector compare when only a few bytes can.
+//
+// Matches are leftmost-longest: of the literals that occur, the one that
+// starts first, and of those the longest, which is what a blocklist wants
+// regardless of the order the literals were given in.
+
+class LiteralSet
+{
+public:
+  // Build from literals, skipping empty ones. With ignorecase ASCII letters
+  // match either case.
+  void build(const std::vector<std::string>& literals, bool ignorecase);
+
+  // Find the leftmost-longest match at or after start, setting [begin, end).
+  bool search(const char* subject, size_t length, size_t start, size_t& begin, size_t& end) const;
+
+  size_t literals() const { return m_literals; }
+  size_t states() const { return m_states.size(); }
+  size_t memory() const;
+
+private:
+  struct State
+  {
+    uint32_t transitions = 0; // index of the first of count entries in m_bytes/m_targets
+    uint32_t count       = 0;
+    uint32_t fail        = 0; // longest proper suffix that is also a trie state
+    uint32_t depth       = 0;
+    uint32_t match       = 0; // length of the longest literal ending here, 0 if none
+  };
+
+  uint32_t next(uint32_t state, uint8_t byte) const;
+  uint32_t edge(uint32_t state, uint8_t byte) const;
+  size_t   skip(const uint8_t* subject, size_t length, size_t pos) const;
+
+  std::vector<State>    m_states;
+  std::vector<uint8_t>  m_bytes;   // trie edge bytes, sorted within a state
+  std::vector<uint32_t> m_targets; // trie edge targets, parallel to m_bytes
+  std::vector<uint32_t> m_rows;    // resolved transitions of the first m_row_states states
+  uint32_t              m_row_states  = 0;
+  uint32_t              m_classes     = 1;  // class 0 is every byte no literal uses
+  uint16_t              m_class[256]  = {}; // by folded byte
+  uint8_t               m_fold[256]   = {}; // ASCII lower case with ignorecase, otherwise identity
+  std::bitset<256>      m_first;            // bytes that can start a match
+  uint8_t               m_starts[4]   = {}; // those bytes, when there are at most 4
+  int                   m_start_count = 0;
+  size_t                m_literals    = 0;
+};
@@ -0,0 +1,100 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string& path)
+{
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return;
+  m_file = file;
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size))
+    return;
+  m_length = (size_t)size.QuadPart;
+  m_ok     = true;
+  if (m_length == 0)
+    return;
+  m_mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (m_mapping)
+    m_data = (const char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+  m_ok = m_data != nullptr;
+}
+
+MappedFile::~MappedFile()
+{
+  if (m_data)
+    UnmapViewOfFile(m_data);
+  if (m_mapping)
+    CloseHandle(m_mapping);
+  if (m_file)
+    CloseHandle(m_file);
+}
+
+void
+MappedFile::release(size_t end)
+{
+  // unlocking pages that are not locked takes them out of the working set
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  size_t page  = info.dwPageSize;
+  size_t begin = m_released;
+  end          = end / page * page;
+  if (!m_data || end <= begin)
+    return;
+  VirtualUnlock((LPVOID)(m_data + begin), end - begin);
+  m_released = end;
+}
+#else
+MappedFile::MappedFile(const std::string& path)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+  {
+    m_length = (size_t)st.st_size;
+    m_ok     = true;
+    if (m_length > 0)
+    {
+      void* data = mmap(nullptr, m_length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED)
+        m_ok = false;
+      else
+      {
+        m_data = (const char*)data;
+        (void)madvise(data, m_length, MADV_SEQUENTIAL);
+      }
+    }
+  }
+  close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+  if (m_data)
+    munmap((void*)m_data, m_length);
+}
+
+void
+MappedFile::release(size_t end)
+{
+  size_t page  = (size_t)sysconf(_SC_PAGESIZE);
+  size_t begin = m_released;
+  end          = end / page * page;
+  if (!m_data || end <= begin)
+    return;
+  (void)madvise((void*)(m_data + begin), end - begin, MADV_DONTNEED);
+  m_released = end;
+}
+#endif
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// A file's contents, mapped read-only. Empty files are not mapped.
+class MappedFile
+{
+public:
+  explicit MappedFile(const std::string& path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&)            = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool        ok() const { return m_ok; }
+  const char* data() const { return m_data ? m_data : ""; }
+  size_t      length() const { return m_data ? m_length : 0; }
+
+  // Let the system drop the pages before end from memory; they are read
+  // from the file again if touched. A hint, so that a long sequential pass
+  // does not keep the whole file resident.
+  void release(size_t end);
+
+private:
+  const char* m_data     = nullptr;
+  size_t      m_length   = 0;
+  size_t      m_released = 0;
+  bool        m_ok       = false;
+#ifdef _WIN32
+  void* m_file    = nullptr;
+  void* m_mapping = nullptr;
+#endif
+};
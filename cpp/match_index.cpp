@@ -0,0 +1,277 @@
+#include "match_index.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+// Whether pattern has a lookahead, which lets a match depend on text past
+// its end. Escapes are skipped; a lookahead spelled inside a class, or in
+// a literal set, only costs a longer rescan.
+bool
+looks_ahead(const std::string& pattern)
+{
+  static const char* const openers[] = { "(?=",   "(?!",   "(*pla:", "(*nla:", "(*napla:", "(*positive_lookahead:",
+                                         "(*negative_lookahead:", "(*non_atomic_positive_lookahead:" };
+  for (size_t i = 0; i < pattern.size(); ++i)
+  {
+    if (pattern[i] == '\\')
+    {
+      ++i;
+      continue;
+    }
+    for (const char* opener : openers)
+    {
+      if (pattern.compare(i, strlen(opener), opener) == 0)
+        return true;
+    }
+  }
+  return false;
+}
+}
+
+bool
+MatchIndex::build(const JanetRegex* regex, const char* text, size_t length, std::string& error)
+{
+  m_spans.clear();
+  RegexMatcherPtr matcher = regex_matcher(regex, false);
+  matcher->reset(text, length, 0);
+  while (matcher->next())
+    m_spans.push_back({ matcher->spans()[0], matcher->spans()[1] });
+  error = matcher->error();
+  if (!error.empty())
+    m_spans.clear();
+  m_gap_begin = m_gap_end = m_spans.size();
+  m_length                = length;
+  return error.empty();
+}
+
+IndexSpan
+MatchIndex::at(size_t i) const
+{
+  if (i < m_gap_begin)
+    return m_spans[i];
+  const IndexSpan& span = m_spans[i + (m_gap_end - m_gap_begin)];
+  return { m_length - span.begin, m_length - span.end };
+}
+
+// Move the gap to before the i'th span, converting the spans it passes.
+void
+MatchIndex::move_gap(size_t i)
+{
+  while (m_gap_begin > i)
+  {
+    IndexSpan span       = m_spans[--m_gap_begin];
+    m_spans[--m_gap_end] = { m_length - span.begin, m_length - span.end };
+  }
+  while (m_gap_begin < i)
+  {
+    IndexSpan span         = m_spans[m_gap_end++];
+    m_spans[m_gap_begin++] = { m_length - span.begin, m_length - span.end };
+  }
+}
+
+bool
+MatchIndex::edit(const JanetRegex* regex, const char* text, size_t length, size_t offset, size_t deleted,
+                 size_t inserted, size_t& from, size_t& to, std::string& error)
+{
+  if (offset > m_length || deleted > m_length - offset || length != m_length - deleted + inserted)
+  {
+    error = "edit does not fit the indexed text";
+    return false;
+  }
+
+  // Keep the matches that end before the edited line, less any empty ones
+  // at the end, which a scan from there would find again. One ending right
+  // at the line may have looked at its first byte, for \b, $ or to stop a
+  // repeat. A lookahead can read further, so for those patterns the line
+  // before is matched again too, and the match before that.
+  bool   ahead = looks_ahead(*regex->pattern);
+  size_t line  = offset;
+  while (line > 0 && text[line - 1] != '\n')
+    --line;
+  if (ahead && line > 0)
+  {
+    --line;
+    while (line > 0 && text[line - 1] != '\n')
+      --line;
+  }
+  size_t low = 0, high = size();
+  while (low < high)
+  {
+    size_t middle = low + (high - low) / 2;
+    if (at(middle).end < line)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  if (ahead && low > 0)
+    --low;
+  while (low > 0 && at(low - 1).begin == at(low - 1).end)
+    --low;
+  size_t start = low > 0 ? at(low - 1).end : 0;
+  move_gap(low);
+
+  // Past the gap, distances from the end hold for the spans after the edit.
+  // Those starting before its end are scanned again, and until the scan
+  // passes the end of one that runs on past the edit, and the lookbehind
+  // beyond that, what it finds may differ from the old matches.
+  size_t edit_end   = offset + inserted;
+  size_t lookbehind = regex->engine->lookbehind(regex);
+  size_t settled    = lookbehind > SIZE_MAX - edit_end ? SIZE_MAX : edit_end + lookbehind;
+  size_t n          = m_spans.size();
+  size_t old        = m_gap_end;
+  for (; old < n && m_spans[old].begin > length - edit_end; ++old)
+  {
+    if (m_spans[old].end <= length - edit_end)
+      settled = std::max(settled, length - m_spans[old].end);
+  }
+
+  // The scan is back in step with the old matches once it finds one of them
+  // past settled, or is searching from a position there that none of them
+  // covers, since both then try the same positions over the same bytes.
+  std::vector<IndexSpan> found;
+  RegexMatcherPtr        matcher   = regex_matcher(regex, false);
+  size_t                 pos       = start;
+  bool                   searching = true; // the matcher's next search is a plain one from pos
+  size_t                 resume    = n;    // old spans from here on are kept
+  matcher->reset(text, length, start);
+  for (;;)
+  {
+    if (searching && pos >= settled)
+    {
+      while (old < n && length - m_spans[old].end <= pos && length - m_spans[old].begin < pos)
+        ++old;
+      if (old == n || length - m_spans[old].begin >= pos)
+      {
+        resume = old;
+        to     = pos;
+        break;
+      }
+    }
+    if (!matcher->next())
+    {
+      error = matcher->error();
+      if (!error.empty())
+        return false;
+      to = length;
+      break;
+    }
+    IndexSpan span = { matcher->spans()[0], matcher->spans()[1] };
+    if (span.begin >= settled)
+    {
+      while (old < n && length - m_spans[old].begin < span.begin)
+        ++old;
+      if (old < n && length - m_spans[old].begin == span.begin && length - m_spans[old].end == span.end)
+      {
+        resume = old;
+        to     = span.begin;
+        break;
+      }
+    }
+    found.push_back(span);
+    pos       = span.end;
+    searching = span.end > span.begin;
+  }
+
+  // the new spans take the place of the old ones in the gap, which grows
+  // with room to spare when they do not fit
+  if (found.size() > resume - m_gap_begin)
+  {
+    size_t grow = found.size() - (resume - m_gap_begin) + m_spans.size() / 8 + 16;
+    m_spans.insert(m_spans.begin() + resume, grow, IndexSpan());
+    resume += grow;
+  }
+  std::copy(found.begin(), found.end(), m_spans.begin() + m_gap_begin);
+  m_gap_begin += found.size();
+  m_gap_end = resume;
+  m_length  = length;
+  from      = start;
+  return true;
+}
+
+void
+MatchIndex::spans(size_t from, size_t to, std::vector<IndexSpan>& out) const
+{
+  size_t low = 0, high = size();
+  while (low < high)
+  {
+    size_t    middle = low + (high - low) / 2;
+    IndexSpan span   = at(middle);
+    if (span.end > from || span.begin >= from)
+      high = middle;
+    else
+      low = middle + 1;
+  }
+  for (size_t i = low; i < size(); ++i)
+  {
+    IndexSpan span = at(i);
+    if (span.begin >= to)
+      break;
+    out.push_back(span);
+  }
+}
+
+int
+match_index_gc(void* data, size_t len)
+{
+  (void)len;
+  if (data)
+  {
+    JanetMatchIndex* index = (JanetMatchIndex*)data;
+    if (index->index)
+    {
+      delete (index->index);
+      index->index = nullptr;
+    }
+  }
+  return 0;
+}
+
+int
+match_index_gcmark(void* data, size_t len)
+{
+  (void)len;
+  JanetMatchIndex* index = (JanetMatchIndex*)data;
+  if (index->regex)
+    janet_mark(janet_wrap_abstract(index->regex));
+  return 0;
+}
+
+void
+match_index_tostring(void* data, JanetBuffer* buffer)
+{
+  if (data)
+  {
+    JanetMatchIndex* index = (JanetMatchIndex*)data;
+    if (!index->index)
+      return;
+    std::string text = std::to_string(index->index->size()) + " matches in " +
+                       std::to_string(index->index->length()) + " bytes";
+    janet_buffer_push_cstring(buffer, text.c_str());
+  }
+}
+
+JanetAbstractType match_index_type = {};
+
+void
+initialize_match_index_type()
+{
+  if (!match_index_type.name)
+  {
+    match_index_type.name     = "jre-match-index";
+    match_index_type.gc       = match_index_gc;
+    match_index_type.gcmark   = match_index_gcmark;
+    match_index_type.tostring = match_index_tostring;
+  }
+}
+
+JanetMatchIndex*
+new_abstract_match_index(JanetRegex* regex)
+{
+  initialize_match_index_type();
+  JanetMatchIndex* index = (JanetMatchIndex*)janet_abstract(&match_index_type, sizeof(JanetMatchIndex));
+  index->regex           = regex;
+  index->index           = new MatchIndex();
+  return index;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <janet.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "regex.h"
+
+// The matches of one regex over a document that is edited in place, for
+// editors that would otherwise run jre/find-all after every keystroke.
+//
+// An edit re-scans from the end of the last match before the edited line,
+// and stops as soon as the scan is back in step with the old matches past
+// the edit plus the regex's lookbehind; the matches after that are kept.
+// They are held in a gap buffer with the gap at the last edit, and those
+// after the gap as distances from the end of the document, so an edit
+// moves no more of them than lie between it and the one before.
+//
+// Matches that end before the edited line are kept as they are, so a
+// pattern whose failed attempts read across lines, say a block comment
+// that is never closed, can miss a match that an edit further down starts
+// above earlier matches. Likewise a lookahead can read past the end of its
+// match: for patterns with one, the line before the edit and the match
+// before that are matched again, but a lookahead reaching further, such
+// as (?=.*\n.*\n.*x) with (?s), can leave a match the edit has broken.
+// Build a new index for those.
+
+// The offsets of one indexed match.
+struct IndexSpan
+{
+  size_t begin = 0;
+  size_t end   = 0;
+};
+
+class MatchIndex
+{
+public:
+  // Find every match in text. Returns false with a message in error when
+  // the engine gives up, leaving the index empty.
+  bool build(const JanetRegex* regex, const char* text, size_t length, std::string& error);
+
+  // Take in an edit that replaced deleted bytes at offset with inserted
+  // ones, giving text. [from, to) is where the matches may have changed.
+  // Returns false with a message in error, and the index unchanged, when
+  // the lengths do not fit the document or the engine gives up.
+  bool edit(const JanetRegex* regex, const char* text, size_t length, size_t offset, size_t deleted,
+            size_t inserted, size_t& from, size_t& to, std::string& error);
+
+  // Spans that overlap [from, to), and empty ones in it, in order.
+  void spans(size_t from, size_t to, std::vector<IndexSpan>& out) const;
+
+  size_t size() const { return m_spans.size() - (m_gap_end - m_gap_begin); }
+  size_t length() const { return m_length; }
+
+private:
+  IndexSpan at(size_t i) const;
+  void      move_gap(size_t i);
+
+  // [0, m_gap_begin) are offsets, [m_gap_end, end) distances from m_length
+  std::vector<IndexSpan> m_spans;
+  size_t                 m_gap_begin = 0;
+  size_t                 m_gap_end   = 0;
+  size_t                 m_length    = 0;
+};
+
+struct JanetMatchIndex
+{
+  JanetGCObject gc;
+  JanetRegex*   regex = nullptr;
+  MatchIndex*   index = nullptr;
+};
+
+extern JanetAbstractType match_index_type;
+
+// An empty index over regex, to build.
+JanetMatchIndex* new_abstract_match_index(JanetRegex* regex);
+
+int  match_index_gc(void* data, size_t len);
+int  match_index_gcmark(void* data, size_t len);
+void match_index_tostring(void* data, JanetBuffer* buffer);
@@ -21,670 +21,803 @@
  */
 #include <janet.h>
 
+#include "lexer.h"
+#include "match_index.h"
+#include "pool.h"
+#include "replace_file.h"
+#include "wrap_nfa.h"
 #include "wrap_pcre2.h"
 #include "wrap_std_regex.h"
 #include "results.h"
+#include "rewriter.h"
+#include "search.h"
+#include "template.h"
 
 #include "module.h"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <sstream>
 
-/*****************/
-/* C++ Functions */
-/*****************/
+/***********/
+/* Helpers */
+/***********/
 
-JANET_FN(cfun_std_compile, "(jre/_std-compile regex &opt flags)",
-         R"(Compile regex for repeated use.
+namespace
+{
+// The regex argument of every native: a compiled regex, or a pattern string
+// compiled with PCRE2 for this call only, which sets local. This is the one
+// type check a call makes, everything else dispatches through the engine.
+JanetRegex*
+get_regex(const Janet* argv, int32_t n, bool& local)
+{
+  local = false;
+  if (janet_checkabstract(argv[n], &regex_type))
+    return (JanetRegex*)janet_unwrap_abstract(argv[n]);
+  if (!janet_checktype(argv[n], JANET_STRING))
+    janet_panicf("bad slot #%d, expected string or compiled regex, got %v", n, argv[n]);
+
+  JanetRegex* regex   = nullptr;
+  Janet       message = janet_wrap_nil();
+  {
+    // scoped so no C++ strings are live at the panic below
+    std::string error;
+    regex = pcre2_engine.compile((const char*)janet_unwrap_string(argv[n]), argv, 0, 0, error);
+    if (!regex)
+      message = janet_cstringv(error.c_str());
+  }
+  if (!regex)
+    janet_panicv(message);
+  local = true;
+  return regex;
+}
+
+// Optional start index, negative values start at 0.
+size_t
+get_start(const Janet* argv, int32_t argc, int32_t n)
+{
+  if (n >= argc || janet_checktype(argv[n], JANET_NIL))
+    return 0;
+  int64_t start = janet_getinteger64(argv, n);
+  return start > 0 ? (size_t)start : 0;
+}
 
-Flags let you control the syntax and contents of the regex
-based on C++ std::regex rules. (https://en.cppreference.com/w/cpp/regex/syntax_option_type)
+// Release a regex compiled for this call, then raise message unless it is nil.
+void
+finish(JanetRegex* regex, bool local, Janet message)
+{
+  if (local)
+    regex_gc(regex, 0);
+  if (!janet_checktype(message, JANET_NIL))
+    janet_panicv(message);
+}
 
-The following options are available:
+Janet
+buffer_to_string(JanetBuffer* out)
+{
+  auto result = janet_string(out->data, out->count);
+  janet_buffer_deinit(out);
+  return janet_wrap_string(result);
+}
+}
 
-* :icase - use case-insensitive matching
-* :optimize - optimize regex for matching speed
-* :collate - character ranges are locale sensitive
+/*************/
+/* Functions */
+/*************/
 
-Grammar options: (These are mutually exclusive)
+JANET_FN(cfun_compile, "(jre/_compile engine patt & flags)",
+         R"(Compile patt with `engine`, one of :pcre2, :std, :nfa or :literals.
 
-* :ecmascript - Modified ECMAScript grammar (https://en.cppreference.com/w/cpp/regex/ecmascript)
-* :basic - basic POSIX regex grammar
-* :extended - extended POSIX regex grammar
-* :awk - POSIX awk regex grammar
-* :grep - POSIX grep regex grammar
-* :egrep - POSIX egrep regex grammar
+The flags each engine accepts are listed in `jre/compile`.
 )")
 {
-  janet_arity(argc, 1, 6);
-  const char* input = janet_getcstring(argv, 0);
-  JanetRegex* regex = new_abstract_regex(input, argv, 1, argc);
-  if (regex->re)
-    return janet_wrap_abstract(regex);
+  janet_arity(argc, 2, -1);
+  const RegexEngine* engine = get_regex_engine(argv[0]);
+  if (!engine)
+    janet_panicf("unknown engine %v, expected one of [:pcre2 :std :nfa :literals]", argv[0]);
 
-  if (regex->pattern)
-  {
-    janet_panic(regex->pattern->c_str());
-  }
-  else
-  {
-    janet_panic("Unknown RE compile error.");
-  }
+  const char* input   = janet_getcstring(argv, 1);
+  JanetRegex* regex   = nullptr;
+  Janet       message = janet_wrap_nil();
+  {
+    // scoped so no C++ strings are live at the panic below
+    std::string error;
+    regex = engine->compile(input, argv, 2, argc, error);
+    if (!regex)
+      message = janet_cstringv(error.c_str());
+  }
+  if (!regex)
+    janet_panicv(message);
+  // the abstract is small, the GC should see what it keeps alive
+  janet_gcpressure(regex->memory);
+  return janet_wrap_abstract(regex);
+}
+
+JANET_FN(cfun_info, "(jre/_info regex)",
+         R"(Return a table describing a compiled regex: engine, pattern, flags, capture
+count and the bytes of native memory it holds.
+
+PCRE2 regexes also report whether JIT compilation succeeded (`:jit`), the
+requested `:jit-mode`, the reason for a JIT failure in `:jit-error`, group
+names in `:names` and whether they were compiled with `:trace`. NFA
+regexes report their program size in `:instructions`, and literal
+dictionaries their term count in `:literals` and automaton size in
+`:states`. `:ignorecase` regexes report the text their subjects are
+scanned for in `:prefilter`.
+)")
+{
+  janet_fixarity(argc, 1);
+  JanetRegex* regex = (JanetRegex*)janet_getabstract(argv, 0, &regex_type);
+  return janet_wrap_table(regex_info(regex));
+}
+
+JANET_FN(cfun_memory, "(jre/_memory &opt regex)",
+         R"(Return the bytes of native memory regex holds, or without it a struct of
+the number of live compiled regexes, their native bytes when compiled, and
+the bytes PCRE2's allocation pool has taken from the system.
+)")
+{
+  janet_arity(argc, 0, 1);
+  if (argc > 0 && !janet_checktype(argv[0], JANET_NIL))
+  {
+    JanetRegex* regex = (JanetRegex*)janet_getabstract(argv, 0, &regex_type);
+    return janet_wrap_number((double)regex_memory(regex));
+  }
+  size_t regexes = 0, bytes = 0;
+  regex_memory_totals(regexes, bytes);
+  JanetKV* totals = janet_struct_begin(3);
+  janet_struct_put(totals, janet_ckeywordv("regexes"), janet_wrap_number((double)regexes));
+  janet_struct_put(totals, janet_ckeywordv("bytes"), janet_wrap_number((double)bytes));
+  janet_struct_put(totals, janet_ckeywordv("pool"), janet_wrap_number((double)pcre2_pool().reserved()));
+  return janet_wrap_struct(janet_struct_end(totals));
+}
+
+JANET_FN(cfun_free_jit_memory, "(jre/_free-jit-memory)",
+         R"(Return the executable memory PCRE2's JIT no longer uses to the system.)")
+{
+  janet_fixarity(argc, 0);
+  (void)argv;
+  pcre2_jit_free_unused_memory(NULL);
   return janet_wrap_nil();
 }
 
-JANET_FN(cfun_std_contains, "(jre/_std-contains regex str)",
-         R"(Match a pre-compiled regex or regex string to an input string.
+JANET_FN(cfun_trace_profile, "(jre/_trace-profile regex &opt reset)",
+         R"(Return the callout counts of a PCRE2 regex compiled with :trace.
 
-Return true if the match regex is in the str.
+An array of {:offset :item :visits :backtracks} structs, one for each
+pattern item matching reached, in pattern order. With reset the counts
+start again from zero.
 )")
+{
+  janet_arity(argc, 1, 2);
+  JanetRegex* regex = (JanetRegex*)janet_getabstract(argv, 0, &regex_type);
+  bool        reset = argc > 1 && janet_truthy(argv[1]);
+  if (regex->engine != &pcre2_engine || !static_cast<JanetPCRE2Regex*>(regex)->trace)
+    janet_panic("regex was not compiled with :trace");
+  return janet_wrap_array(pcre2_trace_profile(static_cast<JanetPCRE2Regex*>(regex), reset));
+}
+
+JANET_FN(cfun_contains, "(jre/_contains regex text)", R"(Quick test for existence of match in text.)")
 {
   janet_fixarity(argc, 2);
+  bool          local;
+  JanetRegex*   regex   = get_regex(argv, 0, local);
+  JanetByteView input   = janet_getbytes(argv, 1);
+  bool          found   = false;
+  Janet         message = janet_wrap_nil();
+  {
+    std::string error;
+    found = regex_contains(regex, (const char*)input.bytes, input.len, 0, error);
+    if (!error.empty())
+      message = janet_cstringv(error.c_str());
+  }
+  finish(regex, local, message);
+  return janet_wrap_boolean(found);
+}
 
-  JanetRegex* regex = NULL;
-  if (janet_checktype(argv[0], JANET_STRING))
-  {
-    const char* re_string = janet_getcstring(argv, 0);
-    regex                 = new_abstract_regex(re_string, argv, 0, 0);
-  }
-  else if (janet_checkabstract(argv[0], &regex_type))
-  {
-    regex = (JanetRegex*)janet_getabstract(argv, 0, &regex_type);
-  }
-  else
-  {
-    janet_panic("First argument must be a string or regex compiled with :std");
+JANET_FN(cfun_match, "(jre/_match regex text &opt start-index intern)",
+         R"(Return array of captured values. With intern, equal short values share one string.)")
+{
+  janet_arity(argc, 2, 4);
+  bool          local;
+  JanetRegex*   regex   = get_regex(argv, 0, local);
+  JanetByteView input   = janet_getbytes(argv, 1);
+  size_t        start   = get_start(argv, argc, 2);
+  bool          intern  = argc == 4 && janet_truthy(argv[3]);
+  Janet         result  = janet_wrap_nil();
+  Janet         message = janet_wrap_nil();
+  {
+    MatchResults& matches = match_arena();
+    std::string   error;
+    if (regex_match(regex, (const char*)input.bytes, input.len, start, false, matches, error))
+      result = MatchResultsToArray(matches, (const char*)input.bytes, intern);
+    else
+      message = janet_cstringv(error.c_str());
   }
+  finish(regex, local, message);
+  return result;
+}
 
-  const char* input  = janet_getcstring(argv, 1);
-  auto        result = false;
-  if (input && regex->re)
-  {
-    std::string s(input);
-    std::smatch m;
-    auto        search_begin = std::sregex_iterator(s.begin(), s.end(), *regex->re);
-    auto        search_end   = std::sregex_iterator();
-    auto        count        = std::distance(search_begin, search_end);
-    return janet_wrap_boolean(count > 0);
-  }
-  return janet_wrap_nil();
+JANET_FN(cfun_match_named, "(jre/_match-named regex text &opt start-index spans)",
+         R"(Return struct of the named groups in the first match, or nil. With spans, values are [begin end].)")
+{
+  janet_arity(argc, 2, 4);
+  bool          local;
+  JanetRegex*   regex   = get_regex(argv, 0, local);
+  JanetByteView input   = janet_getbytes(argv, 1);
+  size_t        start   = get_start(argv, argc, 2);
+  bool          spans   = argc == 4 && janet_truthy(argv[3]);
+  Janet         result  = janet_wrap_nil();
+  Janet         message = janet_wrap_nil();
+  {
+    std::string error;
+    if (!regex_match_named(regex, (const char*)input.bytes, input.len, start, spans, &result, error))
+      message = janet_cstringv(error.c_str());
+  }
+  finish(regex, local, message);
+  return result;
 }
 
-JANET_FN(cfun_std_match, "(jre/_std-match regex text &opt start-index)",
-         R"(Match a pre-compiled regex or regex string to an input string.
+namespace
+{
+Janet
+find_w_options(const Janet* argv, int32_t argc, bool firstOnly)
+{
+  bool          local;
+  JanetRegex*   regex   = get_regex(argv, 0, local);
+  JanetByteView input   = janet_getbytes(argv, 1);
+  size_t        start   = get_start(argv, argc, 2);
+  JanetArray*   array   = janet_array(0);
+  Janet         message = janet_wrap_nil();
+  {
+    std::vector<size_t> begins;
+    std::string         error;
+    if (!regex_find(regex, (const char*)input.bytes, input.len, start, firstOnly, begins, error))
+      message = janet_cstringv(error.c_str());
+    for (auto begin : begins)
+      janet_array_push(array, janet_wrap_integer((int32_t)begin));
+  }
+  finish(regex, local, message);
+  if (firstOnly)
+    return array->count ? array->data[0] : janet_wrap_nil();
+  return janet_wrap_array(array);
+}
+}
 
-Return array of captured values.
-)")
+JANET_FN(cfun_find, "(jre/_find regex text &opt start-index)", R"(Find first index of regex in text.)")
 {
   janet_arity(argc, 2, 3);
+  return find_w_options(argv, argc, true);
+}
 
-  bool        localRegex = false;
-  JanetRegex* regex      = NULL;
-  if (janet_checktype(argv[0], JANET_STRING))
-  {
-    const char* re_string = janet_getcstring(argv, 0);
-    regex                 = new_abstract_regex(re_string, argv, 0, 0);
-    localRegex            = true;
-  }
-  else if (janet_checkabstract(argv[0], &regex_type))
-  {
-    regex = (JanetRegex*)janet_getabstract(argv, 0, &regex_type);
-  }
-  else
-  {
-    janet_panic("First argument must be a string or regex compiled with :std");
-  }
+JANET_FN(cfun_findall, "(jre/_find-all regex text &opt start-index)",
+         R"(Find position of all matches of regex in text.)")
+{
+  janet_arity(argc, 2, 3);
+  return find_w_options(argv, argc, false);
+}
 
-  int startIndex = 0;
-  if (argc == 3)
-  {
-    startIndex = janet_getinteger(argv, 2);
-    if (startIndex <= 0)
-      startIndex = 0;
-  }
+JANET_FN(cfun_find_last, "(jre/_find-last regex text &opt end-index)",
+         R"(Find the index of the rightmost match of regex in text, or in text up to end-index.)")
+{
+  janet_arity(argc, 2, 3);
+  bool          local;
+  JanetRegex*   regex   = get_regex(argv, 0, local);
+  JanetByteView input   = janet_getbytes(argv, 1);
+  size_t        end     = argc > 2 && !janet_checktype(argv[2], JANET_NIL) ? get_start(argv, argc, 2) : input.len;
+  bool          found   = false;
+  size_t        begin   = 0;
+  Janet         message = janet_wrap_nil();
+  {
+    std::string error;
+    if (!regex_find_last(regex, (const char*)input.bytes, std::min(end, (size_t)input.len), found, begin, error))
+      message = janet_cstringv(error.c_str());
+  }
+  finish(regex, local, message);
+  return found ? janet_wrap_integer((int32_t)begin) : janet_wrap_nil();
+}
 
-  const char* input  = janet_getcstring(argv, 1);
-  auto        result = false;
-  if (input && regex->re)
-  {
-    std::string s(input);
-    auto        searchBegin = std::sregex_iterator(s.begin(), s.end(), *regex->re);
-    auto        result = extract_array_from_iterator(s, searchBegin);
-    if (localRegex)
-      set_gc(regex, 0);
-    return janet_wrap_array(result);
-  }
-  if (localRegex)
-    set_gc(regex, 0);
-  return janet_wrap_nil();
+JANET_FN(cfun_count, "(jre/_count regex text &opt start-index)",
+         R"(Count the matches of regex in text, without building match results.)")
+{
+  janet_arity(argc, 2, 3);
+  bool          local;
+  JanetRegex*   regex   = get_regex(argv, 0, local);
+  JanetByteView input   = janet_getbytes(argv, 1);
+  size_t        start   = get_start(argv, argc, 2);
+  int64_t       count   = 0;
+  Janet         message = janet_wrap_nil();
+  {
+    std::string error;
+    count = regex_count(regex, (const char*)input.bytes, input.len, start, error);
+    if (count < 0)
+      message = janet_cstringv(error.c_str());
+  }
+  finish(regex, local, message);
+  return janet_wrap_number((double)count);
+}
+
+JANET_FN(cfun_grep_lines, "(jre/_grep-lines regex text &opt invert max-count output)",
+         R"(Return the lines of text that match regex. `output` is `:both`, `:lines` or `:numbers`.)")
+{
+  janet_arity(argc, 2, 5);
+  bool          local;
+  JanetRegex*   regex   = get_regex(argv, 0, local);
+  JanetByteView input   = janet_getbytes(argv, 1);
+  GrepOptions   options = get_grep_options(argv, argc, 2);
+  JanetArray*   array   = janet_array(0);
+  Janet         message = janet_wrap_nil();
+  {
+    std::string error;
+    if (regex_grep_lines(regex, (const char*)input.bytes, input.len, options, array, error) < 0)
+      message = janet_cstringv(error.c_str());
+  }
+  finish(regex, local, message);
+  return janet_wrap_array(array);
 }
 
-JANET_FN(cfun_std_find, "(jre/_std-find regex text &opt start-index)",
-         R"(Search a pre-compiled regex or regex string inside input text.
+JANET_FN(cfun_extract_columns, "(jre/_extract-columns regex lines &opt intern)",
+         R"(Return an array per capture group of regex, with the group's text in each of lines.
 
-Return position of first match. Optionally, start search at `start-index`.
+`lines` is a list of strings, or text split on newlines. Rows where the
+line does not match, or the group is unset, are nil. With intern, equal
+short values share one string.
 )")
 {
   janet_arity(argc, 2, 3);
-
-  bool        localRegex = false;
-  JanetRegex* regex      = NULL;
-  if (janet_checktype(argv[0], JANET_STRING))
-  {
-    const char* re_string = janet_getcstring(argv, 0);
-    regex                 = new_abstract_regex(re_string, argv, 0, 0);
-    localRegex            = true;
-  }
-  else if (janet_checkabstract(argv[0], &regex_type))
-  {
-    regex = (JanetRegex*)janet_getabstract(argv, 0, &regex_type);
-  }
-  else
+  bool          local;
+  JanetRegex*   regex  = get_regex(argv, 0, local);
+  JanetView     list   = { nullptr, 0 };
+  JanetByteView text   = { nullptr, 0 };
+  bool          intern = argc == 3 && janet_truthy(argv[2]);
+  if (janet_checktypes(argv[1], JANET_TFLAG_BYTES))
+    text = janet_getbytes(argv, 1);
+  else if (!janet_indexed_view(argv[1], &list.items, &list.len))
   {
-    janet_panic("First argument must be a string or regex compiled with :std");
+    finish(regex, local, janet_wrap_nil());
+    janet_panicf("bad slot #1, expected text or list of lines, got %v", argv[1]);
   }
-
-  int startIndex = 0;
-  if (argc == 3)
+  for (int32_t i = 0; i < list.len; ++i)
   {
-    startIndex = janet_getinteger(argv, 2);
-    if (startIndex <= 0)
-      startIndex = 0;
+    if (!janet_checktypes(list.items[i], JANET_TFLAG_BYTES))
+    {
+      finish(regex, local, janet_wrap_nil());
+      janet_panicf("lines must be strings, got %v", list.items[i]);
+    }
   }
 
-  const char* input  = janet_getcstring(argv, 1);
-  int         result = -1;
-  if (input && regex->re)
+  JanetArray* columns = janet_array(0);
+  Janet       message = janet_wrap_nil();
   {
-    std::string s(input);
-
-    auto searchBegin = std::sregex_iterator(s.begin(), s.end(), *regex->re);
-    auto searchEnd   = std::sregex_iterator();
-
-    while (searchBegin != searchEnd)
+    std::vector<JanetByteView> lines;
+    if (text.bytes)
     {
-      if (searchBegin->position() >= startIndex)
+      // a final line without a newline counts, an empty one after the last newline does not
+      const uint8_t* end = text.bytes + text.len;
+      for (const uint8_t* line = text.bytes; line < end;)
       {
-        result = searchBegin->position();
-        break;
+        const uint8_t* newline = (const uint8_t*)memchr(line, '\n', end - line);
+        const uint8_t* eol     = newline ? newline : end;
+        lines.push_back({ line, (int32_t)(eol - line) });
+        line = eol + 1;
       }
-      ++searchBegin;
     }
+    for (int32_t i = 0; i < list.len; ++i)
+    {
+      JanetByteView line;
+      janet_bytes_view(list.items[i], &line.bytes, &line.len);
+      lines.push_back(line);
+    }
+    std::string error;
+    if (!regex_extract_columns(regex, lines, intern, columns, error))
+      message = janet_cstringv(error.c_str());
   }
-
-  // clean up local regex.
-  if (localRegex)
-    set_gc(regex, 0);
-
-  if (result >= 0)
-    return janet_wrap_integer(result);
-  return janet_wrap_nil();
+  finish(regex, local, message);
+  return janet_wrap_array(columns);
 }
 
-JANET_FN(cfun_std_findall, "(jre/_std-findall regex text &opt start-index)",
-         R"(Search a pre-compiled regex or regex string inside input text.
+JANET_FN(cfun_search_paths, "(jre/_search-paths regex paths &opt threads)",
+         R"(Search files and directories for regex on a pool of threads.
 
-Return positions of all matches, optionally only after `start-index`.
+Return an array of [path offset] tuples for every match in every file,
+sorted by path and offset.
 )")
 {
   janet_arity(argc, 2, 3);
-
-  bool        localRegex = false;
-  JanetRegex* regex      = NULL;
-  if (janet_checktype(argv[0], JANET_STRING))
-  {
-    const char* re_string = janet_getcstring(argv, 0);
-    regex                 = new_abstract_regex(re_string, argv, 0, 0);
-    localRegex            = true;
-  }
-  else if (janet_checkabstract(argv[0], &regex_type))
-  {
-    regex = (JanetRegex*)janet_getabstract(argv, 0, &regex_type);
-  }
-  else
-  {
-    janet_panic("First argument must be a string or regex compiled with :std");
-  }
-
-  int startIndex = 0;
-  if (argc == 3)
+  bool        local;
+  JanetRegex* regex   = get_regex(argv, 0, local);
+  JanetView   paths   = janet_getindexed(argv, 1);
+  size_t      threads = janet_optsize(argv, argc, 2, 0);
+  for (int32_t i = 0; i < paths.len; ++i)
   {
-    startIndex = janet_getinteger(argv, 2);
-    if (startIndex <= 0)
-      startIndex = 0;
+    if (!janet_checktypes(paths.items[i], JANET_TFLAG_BYTES))
+    {
+      finish(regex, local, janet_wrap_nil());
+      janet_panicf("paths must be strings, got %v", paths.items[i]);
+    }
   }
 
-  const char* input  = janet_getcstring(argv, 1);
-  JanetArray* result = janet_array(0);
-
-  if (input && regex->re)
+  JanetArray* array   = janet_array(0);
+  Janet       message = janet_wrap_nil();
   {
-    std::string s(input);
-
-    auto searchBegin = std::sregex_iterator(s.begin(), s.end(), *regex->re);
-    auto searchEnd   = std::sregex_iterator();
-
-    while (searchBegin != searchEnd)
+    std::vector<std::string> names;
+    for (int32_t i = 0; i < paths.len; ++i)
+    {
+      JanetByteView name;
+      janet_bytes_view(paths.items[i], &name.bytes, &name.len);
+      names.emplace_back((const char*)name.bytes, name.len);
+    }
+    std::vector<SearchHit> hits;
+    std::string            error;
+    if (search_paths(regex, names, threads, hits, error))
     {
-      if (searchBegin->position() >= startIndex)
-        janet_array_push(result, janet_wrap_integer((int)searchBegin->position()));
-      ++searchBegin;
+      for (auto& hit : hits)
+      {
+        Janet path = janet_stringv((const uint8_t*)hit.path.data(), (int32_t)hit.path.size());
+        for (size_t offset : hit.offsets)
+        {
+          Janet* pair = janet_tuple_begin(2);
+          pair[0]     = path;
+          pair[1]     = janet_wrap_number((double)offset);
+          janet_array_push(array, janet_wrap_tuple(janet_tuple_end(pair)));
+        }
+      }
     }
+    else
+      message = janet_cstringv(error.c_str());
   }
-
-  // clean up local regex.
-  if (localRegex)
-    set_gc(regex, 0);
-
-  return janet_wrap_array(result);
+  finish(regex, local, message);
+  return janet_wrap_array(array);
 }
 
-JANET_FN(cfun_std_replace, "(jre/_std-replace regex text subst)",
-         R"(Replace the first instance of `regex` inside `text` with `subst`.
+JANET_FN(cfun_replace, "(jre/_replace regex text subst &opt all)",
+         R"(Replace the first instance of `regex` inside `text` with `subst`, or every
+instance if `all` is truthy.
 
-If you need a regex with options beyond the default, use `jre/compile`
-to pre-compile it. Otherwise, you can just pass the regex as a string
-and it will be compiled on-the-fly.
+`subst` is either a template from `jre/compile-template`, or a string in
+the engine's own replacement syntax.
 )")
 {
-  janet_fixarity(argc, 3);
-  JanetRegex* regex = NULL;
-  if (janet_checktype(argv[0], JANET_STRING))
-  {
-    const char* re_string = janet_getcstring(argv, 0);
-    regex                 = new_abstract_regex(re_string, argv, 3, argc);
-  }
-  else if (janet_checkabstract(argv[0], &regex_type))
-  {
-    regex = (JanetRegex*)janet_getabstract(argv, 0, &regex_type);
-  }
-  else
-  {
-    janet_panic("First argument must be a string or regex compiled with :std");
-  }
-
-  const char* input   = janet_getcstring(argv, 1);
-  const char* replace = janet_getcstring(argv, 2);
-  if (input && replace && regex->re)
-  {
-    auto result = std::regex_replace(input, *regex->re, replace, std::regex_constants::format_first_only);
-    return janet_wrap_string(janet_cstring(result.c_str()));
-  }
-  return janet_wrap_string(janet_cstring(input));
+  janet_arity(argc, 3, 4);
+  bool           local;
+  JanetRegex*    regex = get_regex(argv, 0, local);
+  JanetByteView  input = janet_getbytes(argv, 1);
+  JanetTemplate* tmpl  = (JanetTemplate*)janet_checkabstract(argv[2], &template_type);
+  const char*    subst = tmpl ? nullptr : janet_getcstring(argv, 2);
+  bool           all   = argc == 4 && janet_truthy(argv[3]);
+
+  JanetBuffer out;
+  Janet       message = janet_wrap_nil();
+  janet_buffer_init(&out, input.len);
+  {
+    // scoped so no C++ strings are live at the panic below
+    std::string error;
+    const char* text = (const char*)input.bytes;
+    bool        ok   = tmpl ? regex_replace_template(regex, text, input.len, tmpl, all, &out, error)
+                            : regex_substitute(regex, text, input.len, subst, all, &out, error);
+    if (!ok)
+      message = janet_cstringv(error.c_str());
+  }
+  if (!janet_checktype(message, JANET_NIL))
+    janet_buffer_deinit(&out);
+  finish(regex, local, message);
+  return buffer_to_string(&out);
 }
 
-JANET_FN(cfun_std_replace_all, "(jre/_std-replace-all regex text subst)",
-         R"(Replace *all* instances of `regex` inside `text` with `subst`.
+JANET_FN(cfun_replace_in_place, "(jre/_replace-in-place regex buffer subst)",
+         R"(Replace every instance of `regex` inside `buffer` with `subst`, rewriting the buffer.
 
-If you need a regex with options beyond the default, use `jre/compile`
-to pre-compile it. Otherwise, you can just pass the regex as a string
-and it will be compiled on-the-fly.
+`subst` is a template from `jre/compile-template` or a string in template
+syntax. Returns the buffer.
 )")
 {
   janet_fixarity(argc, 3);
-  JanetRegex* regex = NULL;
-  if (janet_checktype(argv[0], JANET_STRING))
-  {
-    const char* re_string = janet_getcstring(argv, 0);
-    regex                 = new_abstract_regex(re_string, argv, 3, argc);
-  }
-  else if (janet_checkabstract(argv[0], &regex_type))
-  {
-    regex = (JanetRegex*)janet_getabstract(argv, 0, &regex_type);
-  }
-  else
-  {
-    janet_panic("First argument must be a string or regex compiled with :std");
+  bool           local;
+  JanetRegex*    regex  = get_regex(argv, 0, local);
+  JanetBuffer*   buffer = janet_getbuffer(argv, 1);
+  JanetTemplate* tmpl   = (JanetTemplate*)janet_checkabstract(argv[2], &template_type);
+  if (!tmpl)
+  {
+    tmpl = new_abstract_template(janet_getcstring(argv, 2));
+    if (!tmpl->segments)
+    {
+      if (local)
+        regex_gc(regex, 0);
+      janet_panicv(janet_cstringv(tmpl->source->c_str()));
+    }
   }
 
-  const char* input   = janet_getcstring(argv, 1);
-  const char* replace = janet_getcstring(argv, 2);
-  if (input && replace && regex->re)
+  Janet message = janet_wrap_nil();
   {
-    auto result = std::regex_replace(input, *regex->re, replace);
-    return janet_wrap_string(janet_cstring(result.c_str()));
+    std::string error;
+    if (!regex_replace_in_place(regex, buffer, tmpl, error))
+      message = janet_cstringv(error.c_str());
   }
-  return janet_wrap_string(janet_cstring(input));
+  finish(regex, local, message);
+  return janet_wrap_buffer(buffer);
 }
 
-///////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////
-// PCRE2
-///////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////
+JANET_FN(cfun_replace_file, "(jre/_replace-file regex source destination subst &opt buffer-size)",
+         R"(Replace every instance of `regex` in the file at `source`, writing the result to `destination`.
 
-JANET_FN(cfun_pcre2_compile, "(jre/pcre2-compile patt flags)", R"(JIT compile patt into PCRE2 regex.)")
+The source is mapped rather than read and the output written through a
+buffer of `buffer-size` bytes, 1 MB by default. `subst` is a template from
+`jre/compile-template` or a string in template syntax. Returns the number
+of replacements.
+)")
 {
-  janet_arity(argc, 1, 2);
-  const char*      input = janet_getcstring(argv, 0);
-  JanetPCRE2Regex* regex = new_abstract_pcre2_regex(input, argv, 1, argc);
-  if (regex->re)
-    return janet_wrap_abstract(regex);
-  else
-  {
-    if (regex->pattern)
-    {
-      janet_panic(regex->pattern->c_str());
-    }
-    else
-    {
-      janet_panic("Unknown PCRE2 compile error.");
-    }
-  }
-  return janet_wrap_nil();
+  janet_arity(argc, 4, 5);
+  bool           local;
+  JanetRegex*    regex       = get_regex(argv, 0, local);
+  const char*    source      = janet_getcstring(argv, 1);
+  const char*    destination = janet_getcstring(argv, 2);
+  JanetTemplate* tmpl        = (JanetTemplate*)janet_checkabstract(argv[3], &template_type);
+  size_t         buffer_size = janet_optsize(argv, argc, 4, 1 << 20);
+  if (!tmpl)
+  {
+    tmpl = new_abstract_template(janet_getcstring(argv, 3));
+    if (!tmpl->segments)
+      finish(regex, local, janet_cstringv(tmpl->source->c_str()));
+  }
+  if (buffer_size == 0)
+    finish(regex, local, janet_cstringv("buffer-size must be positive"));
+
+  size_t count   = 0;
+  Janet  message = janet_wrap_nil();
+  {
+    // scoped so no C++ strings are live at the panic below
+    std::string error;
+    if (!replace_file(regex, source, destination, tmpl, buffer_size, count, error))
+      message = janet_cstringv(error.c_str());
+  }
+  finish(regex, local, message);
+  return janet_wrap_number((double)count);
 }
 
-JANET_FN(cfun_pcre2_contains, "(jre/_pcre2-contains regex text)", R"(Quick test for existence of match in text.)")
+JANET_FN(cfun_replace_with, "(jre/_replace-with regex text replacement)",
+         R"(Replace all instances of `regex` inside `text` using `replacement`.
+
+`replacement` is a function, called with the match followed by each capture
+group (nil for unset groups), or a table/struct keyed by the matched text.
+Matches are walked once and the result assembled in a single buffer.
+)")
 {
-  janet_fixarity(argc, 2);
+  janet_fixarity(argc, 3);
+  bool          local;
+  JanetRegex*   regex = get_regex(argv, 0, local);
+  JanetByteView input = janet_getbytes(argv, 1);
+  if (!janet_checktypes(argv[2], JANET_TFLAG_FUNCTION | JANET_TFLAG_DICTIONARY))
+    janet_panic("replacement must be a function, table or struct");
+
+  JanetBuffer out;
+  Janet       error = janet_wrap_nil();
+  janet_buffer_init(&out, input.len);
+  // a regex compiled from a string is not referenced from the stack, keep
+  // it alive while the replacement function runs
+  janet_gcroot(janet_wrap_abstract(regex));
+  {
+    // scoped so the fiber is unrooted before any panic
+    Replacer replacer(argv[2]);
+    if (!regex_replace_with(regex, (const char*)input.bytes, input.len, replacer, &out, &error) &&
+        janet_checktype(error, JANET_NIL))
+      error = janet_cstringv("replacement failed");
+  }
+  janet_gcunroot(janet_wrap_abstract(regex));
+  if (!janet_checktype(error, JANET_NIL))
+    janet_buffer_deinit(&out);
+  finish(regex, local, error);
+  return buffer_to_string(&out);
+}
 
-  JanetPCRE2Regex* regex = NULL;
-  if (janet_checktype(argv[0], JANET_STRING))
-  {
-    const char* re_string = janet_getcstring(argv, 0);
-    regex                 = new_abstract_pcre2_regex(re_string, argv, 0, 0);
-  }
-  else if (janet_checkabstract(argv[0], &pcre2_regex_type))
-  {
-    regex = (JanetPCRE2Regex*)janet_getabstract(argv, 0, &pcre2_regex_type);
-  }
-  else
-  {
-    janet_panic("First argument must be a string or regex compiled with :pcre2");
-  }
+/**************/
+/* Templates  */
+/**************/
 
-  const char* input      = janet_getcstring(argv, 1);
-  PCRE2_SIZE  startIndex = 0;
-  return janet_wrap_boolean(pcre2_contains(regex, input));
+JANET_FN(cfun_compile_template, "(jre/_compile-template template)",
+         R"(Parse a replacement template once for repeated use with either engine.)")
+{
+  janet_fixarity(argc, 1);
+  const char*    input = janet_getcstring(argv, 0);
+  JanetTemplate* tmpl  = new_abstract_template(input);
+  if (!tmpl->segments)
+    janet_panic(tmpl->source->c_str());
+  return janet_wrap_abstract(tmpl);
 }
 
-JANET_FN(cfun_pcre2_find, "(jre/_pcre2-find regex text &opt start-index)", R"(Find first index of regex in text.)")
+JANET_FN(cfun_compile_lexer, "(jre/_compile-lexer rules & flags)",
+         R"(Compile an ordered list of [kind pattern] rules into a PCRE2 lexer.)")
 {
-  janet_arity(argc, 2, 3);
+  janet_arity(argc, 1, -1);
+  JanetView rules = janet_getindexed(argv, 0);
 
-  auto options = PCRE2_SUBSTITUTE_OVERFLOW_LENGTH;
-
-  bool             localRegex = false; // if regex is created here, we need to clean it up on exit
-  JanetPCRE2Regex* regex      = NULL;
-  if (janet_checktype(argv[0], JANET_STRING))
-  {
-    // TODO handle failed to compile local regex from string
-    const char* re_string = janet_getcstring(argv, 0);
-    regex                 = new_abstract_pcre2_regex(re_string, argv, 0, 0);
-    localRegex            = true;
-  }
-  else if (janet_checkabstract(argv[0], &pcre2_regex_type))
-  {
-    regex = (JanetPCRE2Regex*)janet_getabstract(argv, 0, &pcre2_regex_type);
-  }
-  else
+  // check every rule before any C++ state exists, janet_panic skips destructors
+  for (int32_t i = 0; i < rules.len; ++i)
   {
-    janet_panic("First argument must be a string or regex compiled with :pcre2");
+    JanetView rule;
+    if (!janet_indexed_view(rules.items[i], &rule.items, &rule.len) || rule.len != 2 ||
+        !janet_checktype(rule.items[1], JANET_STRING))
+      janet_panicf("lexer rule %d must be [kind pattern], got %v", i, rules.items[i]);
   }
 
-  PCRE2_SIZE startIndex = 0;
-  if (argc == 3)
+  JanetLexer* lexer = nullptr;
   {
-    startIndex = janet_getinteger(argv, 2);
-    if (startIndex <= 0)
-      startIndex = 0;
+    std::vector<std::string> patterns;
+    Janet*                   kinds = janet_tuple_begin(rules.len);
+    for (int32_t i = 0; i < rules.len; ++i)
+    {
+      JanetView rule;
+      janet_indexed_view(rules.items[i], &rule.items, &rule.len);
+      kinds[i] = rule.items[0];
+      patterns.emplace_back((const char*)janet_unwrap_string(rule.items[1]));
+    }
+    lexer = new_abstract_lexer(patterns, janet_tuple_end(kinds), argv + 1, argc - 1);
   }
-
-  const char* input = janet_getcstring(argv, 1);
-
-  bool firstOnly = true;
-  auto matches   = pcre2_match(regex, input, startIndex, options, firstOnly);
-  if (localRegex)
-    pcre2_set_gc(regex, 0);
-  if (matches.empty())
-    return janet_wrap_nil();
-
-  return janet_wrap_integer(matches.at(0).begin);
+  if (!lexer->regex)
+    janet_panic(lexer->error->c_str());
+  return janet_wrap_abstract(lexer);
 }
 
-JANET_FN(cfun_pcre2_findall, "(jre/_pcre2-findall regex text &opt start-index)",
-         R"(Find position of all matches of regex in text.)")
+JANET_FN(cfun_lexer_next, "(jre/_lexer-next lexer text pos)",
+         R"(Return the [kind begin end] token at pos in text, or nil at the end of text.)")
 {
-  janet_arity(argc, 2, 3);
-
-  auto options = PCRE2_SUBSTITUTE_OVERFLOW_LENGTH | PCRE2_SUBSTITUTE_GLOBAL;
+  janet_fixarity(argc, 3);
+  JanetLexer*   lexer = (JanetLexer*)janet_getabstract(argv, 0, &lexer_type);
+  JanetByteView input = janet_getbytes(argv, 1);
+  size_t        pos   = janet_getsize(argv, 2);
 
-  // if regex is created here, we need to clean it up on exit
-  bool             localRegex = false;
-  JanetPCRE2Regex* regex      = NULL;
-  if (janet_checktype(argv[0], JANET_STRING))
-  {
-    // TODO handle failed to compile local regex from string
-    const char* re_string = janet_getcstring(argv, 0);
-    regex                 = new_abstract_pcre2_regex(re_string, argv, 0, 0);
-    localRegex            = true;
-  }
-  else if (janet_checkabstract(argv[0], &pcre2_regex_type))
-  {
-    regex = (JanetPCRE2Regex*)janet_getabstract(argv, 0, &pcre2_regex_type);
-  }
-  else
+  Janet token   = janet_wrap_nil();
+  Janet message = janet_wrap_nil();
   {
-    janet_panic("First argument must be a string or regex compiled with :pcre2");
+    std::string error;
+    token = lexer_next(lexer, (const char*)input.bytes, input.len, pos, error);
+    if (!error.empty())
+      message = janet_cstringv(error.c_str());
   }
+  if (!janet_checktype(message, JANET_NIL))
+    janet_panicv(message);
+  return token;
+}
 
-  PCRE2_SIZE startIndex = 0;
-  if (argc == 3)
-  {
-    startIndex = janet_getinteger(argv, 2);
-    if (startIndex <= 0)
-      startIndex = 0;
+JANET_FN(cfun_compile_rewriter, "(jre/_compile-rewriter rules & flags)",
+         R"(Compile an ordered list of [pattern replacement] rules into a one-pass PCRE2 rewriter.)")
+{
+  janet_arity(argc, 1, -1);
+  JanetView rules     = janet_getindexed(argv, 0);
+  Janet*    templates = janet_tuple_begin(rules.len);
+
+  // check every rule and parse its template before any C++ state exists,
+  // janet_panic skips destructors
+  for (int32_t i = 0; i < rules.len; ++i)
+  {
+    JanetView rule;
+    if (!janet_indexed_view(rules.items[i], &rule.items, &rule.len) || rule.len != 2 ||
+        !janet_checktype(rule.items[0], JANET_STRING) ||
+        !(janet_checktype(rule.items[1], JANET_STRING) || janet_checkabstract(rule.items[1], &template_type)))
+      janet_panicf("rewriter rule %d must be [pattern replacement], got %v", i, rules.items[i]);
+    templates[i] = rule.items[1];
+    if (janet_checktype(rule.items[1], JANET_STRING))
+    {
+      JanetTemplate* tmpl = new_abstract_template((const char*)janet_unwrap_string(rule.items[1]));
+      if (!tmpl->segments)
+        janet_panicf("rewriter rule %d: %s", i, tmpl->source->c_str());
+      templates[i] = janet_wrap_abstract(tmpl);
+    }
   }
 
-  const char* input = janet_getcstring(argv, 1);
-
-  auto matches = pcre2_match(regex, input, startIndex, options);
-  if (localRegex)
-    pcre2_set_gc(regex, 0);
-
-  JanetArray* array = janet_array(matches.size());
-  for (auto&& m : matches)
+  JanetRewriter* rewriter = nullptr;
   {
-    janet_array_push(array, janet_wrap_number(m.begin));
+    std::vector<std::string> patterns;
+    for (int32_t i = 0; i < rules.len; ++i)
+    {
+      JanetView rule;
+      janet_indexed_view(rules.items[i], &rule.items, &rule.len);
+      patterns.emplace_back((const char*)janet_unwrap_string(rule.items[0]));
+    }
+    rewriter = new_abstract_rewriter(patterns, janet_tuple_end(templates), argv + 1, argc - 1);
   }
-  return janet_wrap_array(array);
+  if (!rewriter->regex)
+    janet_panic(rewriter->error->c_str());
+  return janet_wrap_abstract(rewriter);
 }
 
-JANET_FN(cfun_pcre2_match, "(jre/_pcre2-match regex text &opt start-index)", R"(Return array of captured values.)")
+JANET_FN(cfun_rewrite, "(jre/_rewrite rewriter text)",
+         R"(Return text with the matches of every rule replaced, in one pass.)")
 {
-  janet_arity(argc, 2, 3);
-
-  auto options = PCRE2_SUBSTITUTE_OVERFLOW_LENGTH | PCRE2_SUBSTITUTE_GLOBAL;
+  janet_fixarity(argc, 2);
+  JanetRewriter* rewriter = (JanetRewriter*)janet_getabstract(argv, 0, &rewriter_type);
+  JanetByteView  input    = janet_getbytes(argv, 1);
 
-  // if regex is created here, we need to clean it up on exit
-  bool             localRegex = false;
-  JanetPCRE2Regex* regex      = NULL;
-  if (janet_checktype(argv[0], JANET_STRING))
-  {
-    // TODO handle failed to compile local regex from string
-    const char* re_string = janet_getcstring(argv, 0);
-    regex                 = new_abstract_pcre2_regex(re_string, argv, 0, 0);
-    localRegex            = true;
-  }
-  else if (janet_checkabstract(argv[0], &pcre2_regex_type))
-  {
-    regex = (JanetPCRE2Regex*)janet_getabstract(argv, 0, &pcre2_regex_type);
-  }
-  else
+  JanetBuffer out;
+  Janet       message = janet_wrap_nil();
+  janet_buffer_init(&out, input.len);
   {
-    janet_panic("First argument must be a string or regex compiled with :pcre2");
+    // scoped so no C++ strings are live at the panic below
+    std::string error;
+    if (!rewriter_rewrite(rewriter, (const char*)input.bytes, input.len, &out, error))
+      message = janet_cstringv(error.c_str());
   }
-
-  PCRE2_SIZE startIndex = 0;
-  if (argc == 3)
+  if (!janet_checktype(message, JANET_NIL))
   {
-    startIndex = janet_getinteger(argv, 2);
-    if (startIndex <= 0)
-      startIndex = 0;
+    janet_buffer_deinit(&out);
+    janet_panicv(message);
   }
-
-  const char* input = janet_getcstring(argv, 1);
-
-  auto matches = pcre2_match(regex, input, startIndex, options);
-  auto array   = MatchResultsToArray(matches);
-
-  if (localRegex)
-    pcre2_set_gc(regex, 0);
-
-  return array;
+  return buffer_to_string(&out);
 }
 
-Janet
-pcre2_replace_w_options(JanetPCRE2Regex* regex, const char* input, const char* replace, bool all)
-{
-  if (input && replace && regex->re)
-  {
-    // need to dynamically size, based on size of matches and number of matches?
-    auto match_data = pcre2_match_data_create_from_pattern(regex->re, NULL);
-    int  rc;
-    if (regex->jit)
-    {
-      rc = pcre2_jit_match(regex->re,         /* the compiled pattern */
-                           (PCRE2_SPTR)input, /* the subject string */
-                           strlen(input),     /* the length of the subject */
-                           0,                 /* start at offset 0 in the subject */
-                           0,                 /* default options */
-                           match_data,        /* block for storing the result */
-                           NULL);
-    }
-    else
-    {
-      rc = pcre2_match(regex->re,         /* the compiled pattern */
-                       (PCRE2_SPTR)input, /* the subject string */
-                       strlen(input),     /* the length of the subject */
-                       0,                 /* start at offset 0 in the subject */
-                       0,                 /* default options */
-                       match_data,        /* block for storing the result */
-                       NULL);
-    }
-
-    // if there is no original match, return the input string
-    if (rc < 0)
-    {
-      pcre2_match_data_free(match_data);
-      return janet_wrap_string(janet_cstring(input));
-    }
+JANET_FN(cfun_match_index, "(jre/_match-index regex text)",
+         R"(Index the matches of regex in text, to keep up to date with jre/_index-edit.
 
-    PCRE2_UCHAR output[2048] = "";
-    PCRE2_SIZE  outlen       = sizeof(output) / sizeof(PCRE2_UCHAR);
-
-    auto options = PCRE2_SUBSTITUTE_OVERFLOW_LENGTH;
-    if (all)
-      options |= PCRE2_SUBSTITUTE_GLOBAL;
-
-    rc = pcre2_substitute(regex->re,
-                          (PCRE2_SPTR)input,   // input string to replace into
-                          strlen(input),       // length of input string
-                          0,                   // offset
-                          options,             // options
-                          match_data,          // match_data
-                          NULL,                // mcontext
-                          (PCRE2_SPTR)replace, // string to replace matches with
-                          strlen(replace),     // length of replacement string
-                          output,              // output buffer
-                          &outlen);
-
-    PCRE2_UCHAR* out2 = nullptr;
-    if (rc == PCRE2_ERROR_NOMEMORY)
-    {
-      printf("ran out of memory, input: %zu needed: %zu\n", strlen(input), outlen);
-      out2 = (PCRE2_UCHAR*)malloc(outlen * sizeof(PCRE2_UCHAR));
-      rc   = pcre2_substitute(regex->re,
-                              (PCRE2_SPTR)input,   // input string to replace into
-                              strlen(input),       // length of input string
-                              0,                   // offset
-                              options,             // options
-                              match_data,          // match_data
-                              NULL,                // mcontext
-                              (PCRE2_SPTR)replace, // string to replace matches with
-                              strlen(replace),     // length of replacement string
-                              out2,                // output buffer
-                              &outlen);
-    }
-
-    pcre2_match_data_free(match_data);
-    if (rc >= 0)
-    {
-      if (out2)
-      {
-        auto res = janet_wrap_string(janet_cstring((char*)out2));
-        free(out2);
-        return res;
-      }
-      else
-      {
-        return janet_wrap_string(janet_cstring((char*)output));
-      }
-    }
-    else if (out2)
-    {
-      free(out2);
-    }
-  }
-  return janet_wrap_string(janet_cstring(input));
+A pattern string is compiled once and kept with the index.)")
+{
+  janet_fixarity(argc, 2);
+  bool             local;
+  JanetRegex*      regex   = get_regex(argv, 0, local);
+  JanetByteView    input   = janet_getbytes(argv, 1);
+  JanetMatchIndex* index   = new_abstract_match_index(regex);
+  if (local)
+    janet_gcpressure(regex->memory);
+  Janet            message = janet_wrap_nil();
+  {
+    std::string error;
+    if (!index->index->build(regex, (const char*)input.bytes, input.len, error))
+      message = janet_cstringv(error.c_str());
+  }
+  if (!janet_checktype(message, JANET_NIL))
+    janet_panicv(message);
+  return janet_wrap_abstract(index);
 }
 
-JANET_FN(cfun_pcre2_replace, "(jre/pcre2-replace regex text subst)",
-         R"(Replace first instance of `regex` inside `text` with `subst`.
+JANET_FN(cfun_index_edit, "(jre/_index-edit index text offset deleted inserted)",
+         R"(Update index for an edit that replaced deleted bytes at offset, giving text.
 
-If you need a regex with options beyond the default, use `jre/pcre2-compile`
-to pre-compile it. Otherwise, you can just pass the regex as a string
-and it will be compiled on-the-fly.
-)")
+`inserted` is the inserted text or its length. Return the [from to] range of
+text whose matches may have changed.)")
 {
-  janet_fixarity(argc, 3);
-  JanetPCRE2Regex* regex = NULL;
-  if (janet_checktype(argv[0], JANET_STRING))
-  {
-    const char* re_string = janet_getcstring(argv, 0);
-    regex                 = new_abstract_pcre2_regex(re_string, argv, 3, argc);
-  }
-  else if (janet_checkabstract(argv[0], &pcre2_regex_type))
-  {
-    regex = (JanetPCRE2Regex*)janet_getabstract(argv, 0, &pcre2_regex_type);
-  }
-  else
-  {
-    janet_panic("First argument must be a string or regex compiled with :pcre2");
-  }
-
-  const char* input   = janet_getcstring(argv, 1);
-  const char* replace = janet_getcstring(argv, 2);
-  return pcre2_replace_w_options(regex, input, replace, false);
+  janet_fixarity(argc, 5);
+  JanetMatchIndex* index    = (JanetMatchIndex*)janet_getabstract(argv, 0, &match_index_type);
+  JanetByteView    input    = janet_getbytes(argv, 1);
+  size_t           offset   = janet_getsize(argv, 2);
+  size_t           deleted  = janet_getsize(argv, 3);
+  size_t           inserted = janet_checktype(argv[4], JANET_NUMBER) ? janet_getsize(argv, 4)
+                                                                     : (size_t)janet_getbytes(argv, 4).len;
+  size_t from = 0, to = 0;
+  Janet  message = janet_wrap_nil();
+  {
+    std::string error;
+    if (!index->index->edit(index->regex, (const char*)input.bytes, input.len, offset, deleted, inserted, from, to,
+                            error))
+      message = janet_cstringv(error.c_str());
+  }
+  if (!janet_checktype(message, JANET_NIL))
+    janet_panicv(message);
+  Janet* range = janet_tuple_begin(2);
+  range[0]     = janet_wrap_number((double)from);
+  range[1]     = janet_wrap_number((double)to);
+  return janet_wrap_tuple(janet_tuple_end(range));
 }
 
-JANET_FN(cfun_pcre2_replace_all, "(jre/pcre2-replace-all regex text subst)",
-         R"(Replace *all* instances of `regex` inside `text` with `subst`.
-
-If you need a regex with options beyond the default, use `jre/pcre2-compile`
-to pre-compile it. Otherwise, you can just pass the regex as a string
-and it will be compiled on-the-fly.
-)")
+JANET_FN(cfun_index_spans, "(jre/_index-spans index &opt from to)",
+         R"(Return an array of [begin end] tuples for the indexed matches that overlap [from, to).)")
 {
-  janet_fixarity(argc, 3);
-  JanetPCRE2Regex* regex = NULL;
-  if (janet_checktype(argv[0], JANET_STRING))
-  {
-    const char* re_string = janet_getcstring(argv, 0);
-    regex                 = new_abstract_pcre2_regex(re_string, argv, 3, argc);
-  }
-  else if (janet_checkabstract(argv[0], &pcre2_regex_type))
-  {
-    regex = (JanetPCRE2Regex*)janet_getabstract(argv, 0, &pcre2_regex_type);
-  }
-  else
-  {
-    janet_panic("First argument must be a string or regex compiled with :pcre2");
+  janet_arity(argc, 1, 3);
+  JanetMatchIndex* index = (JanetMatchIndex*)janet_getabstract(argv, 0, &match_index_type);
+  size_t           from  = get_start(argv, argc, 1);
+  size_t           to    = argc > 2 && !janet_checktype(argv[2], JANET_NIL) ? janet_getsize(argv, 2) : SIZE_MAX;
+  JanetArray*      array = nullptr;
+  {
+    std::vector<IndexSpan> spans;
+    index->index->spans(from, to, spans);
+    array = janet_array((int32_t)spans.size());
+    for (auto&& span : spans)
+    {
+      Janet* pair = janet_tuple_begin(2);
+      pair[0]     = janet_wrap_number((double)span.begin);
+      pair[1]     = janet_wrap_number((double)span.end);
+      janet_array_push(array, janet_wrap_tuple(janet_tuple_end(pair)));
+    }
   }
-
-  const char* input   = janet_getcstring(argv, 1);
-  const char* replace = janet_getcstring(argv, 2);
-  return pcre2_replace_w_options(regex, input, replace, true);
+  return janet_wrap_array(array);
 }
 
 /****************/
@@ -693,20 +826,36 @@ and it will be compiled on-the-fly.
 
 JANET_MODULE_ENTRY(JanetTable* env)
 {
-  JanetRegExt cfuns[] = { JANET_REG("std-compile", cfun_std_compile),
-                          JANET_REG("std-contains", cfun_std_contains),
-                          JANET_REG("std-match", cfun_std_match),
-                          JANET_REG("std-find", cfun_std_find),
-                          JANET_REG("std-find-all", cfun_std_findall),
-                          JANET_REG("std-replace", cfun_std_replace),
-                          JANET_REG("std-replace-all", cfun_std_replace_all),
-                          JANET_REG("pcre2-compile", cfun_pcre2_compile),
-                          JANET_REG("pcre2-contains", cfun_pcre2_contains),
-                          JANET_REG("pcre2-match", cfun_pcre2_match),
-                          JANET_REG("pcre2-find", cfun_pcre2_find),
-                          JANET_REG("pcre2-find-all", cfun_pcre2_findall),
-                          JANET_REG("pcre2-replace", cfun_pcre2_replace),
-                          JANET_REG("pcre2-replace-all", cfun_pcre2_replace_all),
+  initialize_regex_type();
+  // so marshalled regexes can be found again by name
+  janet_register_abstract_type(&regex_type);
+  JanetRegExt cfuns[] = { JANET_REG("compile", cfun_compile),
+                          JANET_REG("info", cfun_info),
+                          JANET_REG("memory", cfun_memory),
+                          JANET_REG("free-jit-memory", cfun_free_jit_memory),
+                          JANET_REG("trace-profile", cfun_trace_profile),
+                          JANET_REG("contains", cfun_contains),
+                          JANET_REG("match", cfun_match),
+                          JANET_REG("match-named", cfun_match_named),
+                          JANET_REG("find", cfun_find),
+                          JANET_REG("find-all", cfun_findall),
+                          JANET_REG("find-last", cfun_find_last),
+                          JANET_REG("count", cfun_count),
+                          JANET_REG("grep-lines", cfun_grep_lines),
+                          JANET_REG("extract-columns", cfun_extract_columns),
+                          JANET_REG("search-paths", cfun_search_paths),
+                          JANET_REG("replace", cfun_replace),
+                          JANET_REG("replace-in-place", cfun_replace_in_place),
+                          JANET_REG("replace-file", cfun_replace_file),
+                          JANET_REG("replace-with", cfun_replace_with),
+                          JANET_REG("compile-template", cfun_compile_template),
+                          JANET_REG("compile-lexer", cfun_compile_lexer),
+                          JANET_REG("lexer-next", cfun_lexer_next),
+                          JANET_REG("compile-rewriter", cfun_compile_rewriter),
+                          JANET_REG("rewrite", cfun_rewrite),
+                          JANET_REG("match-index", cfun_match_index),
+                          JANET_REG("index-edit", cfun_index_edit),
+                          JANET_REG("index-spans", cfun_index_spans),
                           JANET_REG_END };
   janet_cfuns_ext(env, "re-janet", cfuns);
 }
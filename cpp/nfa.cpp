@@ -0,0 +1,916 @@
+#include "nfa.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+namespace
+{
+// limits that keep compile time and matcher memory bounded
+const int    max_repeat = 1000;
+const size_t max_insts  = 50000;
+const int    max_depth  = 250;
+
+struct Node
+{
+  enum Kind
+  {
+    Empty,
+    Byte,
+    Class,
+    Any,
+    Concat,
+    Alt,
+    Repeat,
+    Group,
+    Assert,
+  };
+
+  Kind              kind      = Empty;
+  uint8_t           byte      = 0;
+  int               cls       = 0;  // index into the class table
+  NFAAssert         assertion = NFAAssert::TextStart;
+  int               min       = 0;
+  int               max       = 0;  // -1 for no upper bound
+  bool              greedy    = true;
+  int               capture   = -1; // group number, -1 for (?:...)
+  std::vector<Node> children  = {};
+};
+
+bool
+is_word(uint8_t c)
+{
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+void
+add_range(std::bitset<256>& set, int lo, int hi)
+{
+  for (int c = lo; c <= hi; ++c)
+    set.set(c);
+}
+
+// \d \w \s and their negations, false for any other letter
+bool
+add_perl_class(std::bitset<256>& set, char c)
+{
+  std::bitset<256> cls;
+  switch (c)
+  {
+  case 'd':
+  case 'D':
+    add_range(cls, '0', '9');
+    break;
+  case 'w':
+  case 'W':
+    for (int b = 0; b < 256; ++b)
+      if (is_word((uint8_t)b))
+        cls.set(b);
+    break;
+  case 's':
+  case 'S':
+    for (char b : { ' ', '\t', '\n', '\r', '\f', '\v' })
+      cls.set((uint8_t)b);
+    break;
+  default:
+    return false;
+  }
+  if (c >= 'A' && c <= 'Z')
+    cls.flip();
+  set |= cls;
+  return true;
+}
+
+bool
+add_posix_class(std::bitset<256>& set, const std::string& name)
+{
+  for (int c = 0; c < 256; ++c)
+  {
+    bool in = false;
+    if (name == "alpha")
+      in = isalpha(c);
+    else if (name == "digit")
+      in = isdigit(c);
+    else if (name == "alnum")
+      in = isalnum(c);
+    else if (name == "upper")
+      in = isupper(c);
+    else if (name == "lower")
+      in = islower(c);
+    else if (name == "space")
+      in = isspace(c);
+    else if (name == "blank")
+      in = c == ' ' || c == '\t';
+    else if (name == "punct")
+      in = ispunct(c);
+    else if (name == "print")
+      in = isprint(c);
+    else if (name == "graph")
+      in = isgraph(c);
+    else if (name == "cntrl")
+      in = iscntrl(c);
+    else if (name == "xdigit")
+      in = isxdigit(c);
+    else if (name == "word")
+      in = is_word((uint8_t)c);
+    else
+      return false;
+    if (in && c < 128)
+      set.set(c);
+  }
+  return true;
+}
+
+class Parser
+{
+public:
+  Parser(const std::string& pattern, uint32_t options, std::vector<std::bitset<256>>& classes)
+      : m_pattern(pattern), m_options(options), m_classes(classes)
+  {
+  }
+
+  bool parse(Node& root, std::string& error)
+  {
+    if (!parse_alt(root, 0) || (m_pos < m_pattern.size() && fail("unmatched )")))
+    {
+      std::ostringstream os;
+      os << "NFA compilation failed, pattern: '" << m_pattern << "', offset " << m_pos << ": " << m_error << ".";
+      error = os.str();
+      return false;
+    }
+    return true;
+  }
+
+  int captures() const { return m_captures; }
+
+private:
+  bool fail(const char* message)
+  {
+    m_error = message;
+    return true;
+  }
+
+  bool at_end() const { return m_pos >= m_pattern.size(); }
+  char peek() const { return m_pattern[m_pos]; }
+
+  bool parse_alt(Node& node, int depth)
+  {
+    if (depth > max_depth)
+      return !fail("groups nested too deeply");
+    Node branch;
+    if (!parse_concat(branch, depth))
+      return false;
+    if (at_end() || peek() != '|')
+    {
+      node = std::move(branch);
+      return true;
+    }
+    node.kind = Node::Alt;
+    node.children.push_back(std::move(branch));
+    while (!at_end() && peek() == '|')
+    {
+      ++m_pos;
+      Node next;
+      if (!parse_concat(next, depth))
+        return false;
+      node.children.push_back(std::move(next));
+    }
+    return true;
+  }
+
+  bool parse_concat(Node& node, int depth)
+  {
+    node.kind = Node::Concat;
+    while (!at_end() && peek() != '|' && peek() != ')')
+    {
+      Node atom;
+      if (!parse_atom(atom, depth) || !parse_quantifier(atom))
+        return false;
+      node.children.push_back(std::move(atom));
+    }
+    return true;
+  }
+
+  // reads {n}, {n,} or {n,m}; anything else leaves `{` as a literal
+  bool parse_braces(int& min, int& max)
+  {
+    size_t pos    = m_pos + 1;
+    auto   number = [&](int& value) {
+      size_t begin = pos;
+      value        = 0;
+      while (pos < m_pattern.size() && isdigit((uint8_t)m_pattern[pos]))
+        value = std::min(value * 10 + (m_pattern[pos++] - '0'), max_repeat + 1);
+      return pos > begin;
+    };
+    if (!number(min))
+      return false;
+    max = min;
+    if (pos < m_pattern.size() && m_pattern[pos] == ',')
+    {
+      ++pos;
+      if (!number(max))
+        max = -1;
+    }
+    if (pos >= m_pattern.size() || m_pattern[pos] != '}')
+      return false;
+    m_pos = pos + 1;
+    return true;
+  }
+
+  bool parse_quantifier(Node& atom)
+  {
+    if (at_end())
+      return true;
+    int  min = 0;
+    int  max = 0;
+    char c   = peek();
+    if (c == '*' || c == '+' || c == '?')
+    {
+      min = c == '+' ? 1 : 0;
+      max = c == '?' ? 1 : -1;
+      ++m_pos;
+    }
+    else if (c != '{' || !parse_braces(min, max))
+    {
+      return true;
+    }
+
+    if (min > max_repeat || max > max_repeat)
+      return !fail("repeat count too large");
+    if (max != -1 && max < min)
+      return !fail("numbers out of order in {} quantifier");
+    if (atom.kind == Node::Assert || atom.kind == Node::Empty)
+      return !fail("quantifier does not follow a repeatable item");
+
+    Node repeat;
+    repeat.kind   = Node::Repeat;
+    repeat.min    = min;
+    repeat.max    = max;
+    repeat.greedy = true;
+    if (!at_end() && peek() == '?')
+    {
+      repeat.greedy = false;
+      ++m_pos;
+    }
+    if (!at_end() && (peek() == '*' || peek() == '+' || peek() == '?'))
+      return !fail("nested quantifiers are not supported");
+    repeat.children.push_back(std::move(atom));
+    atom = std::move(repeat);
+    return true;
+  }
+
+  void byte_node(Node& node, uint8_t c)
+  {
+    if ((m_options & NFA_IGNORECASE) && isalpha(c))
+    {
+      std::bitset<256> set;
+      set.set(tolower(c));
+      set.set(toupper(c));
+      class_node(node, set);
+      return;
+    }
+    node.kind = Node::Byte;
+    node.byte = c;
+  }
+
+  void fold_case(std::bitset<256>& set)
+  {
+    for (int c = 'a'; c <= 'z'; ++c)
+    {
+      if (set[c] || set[c - 32])
+      {
+        set.set(c);
+        set.set(c - 32);
+      }
+    }
+  }
+
+  // case folding happens before any negation, so [^a] excludes A too
+  void class_node(Node& node, std::bitset<256> set, bool fold = true)
+  {
+    if (fold && (m_options & NFA_IGNORECASE))
+      fold_case(set);
+    node.kind = Node::Class;
+    node.cls  = (int)m_classes.size();
+    m_classes.push_back(set);
+  }
+
+  void assert_node(Node& node, NFAAssert assertion)
+  {
+    node.kind      = Node::Assert;
+    node.assertion = assertion;
+  }
+
+  // escapes shared by atoms and classes; sets `c` for a single byte
+  bool parse_escape_byte(char e, uint8_t& c)
+  {
+    switch (e)
+    {
+    case 'n':
+      c = '\n';
+      return true;
+    case 't':
+      c = '\t';
+      return true;
+    case 'r':
+      c = '\r';
+      return true;
+    case 'f':
+      c = '\f';
+      return true;
+    case 'v':
+      c = '\v';
+      return true;
+    case 'e':
+      c = 0x1b;
+      return true;
+    case 'x':
+    {
+      int value = 0;
+      int n     = 0;
+      while (n < 2 && !at_end() && isxdigit((uint8_t)peek()))
+      {
+        char h = peek();
+        value  = value * 16 + (isdigit((uint8_t)h) ? h - '0' : tolower(h) - 'a' + 10);
+        ++m_pos;
+        ++n;
+      }
+      if (n == 0)
+        return false;
+      c = (uint8_t)value;
+      return true;
+    }
+    default:
+      if (!isalnum((uint8_t)e))
+      {
+        c = (uint8_t)e;
+        return true;
+      }
+      return false;
+    }
+  }
+
+  bool parse_atom(Node& node, int depth)
+  {
+    char c = m_pattern[m_pos++];
+    switch (c)
+    {
+    case '(':
+      return parse_group(node, depth);
+    case '[':
+      return parse_class(node);
+    case '.':
+      node.kind = Node::Any;
+      return true;
+    case '^':
+      assert_node(node, (m_options & NFA_MULTILINE) ? NFAAssert::LineStart : NFAAssert::TextStart);
+      return true;
+    case '$':
+      assert_node(node, (m_options & NFA_MULTILINE) ? NFAAssert::LineEnd : NFAAssert::TextEnd);
+      return true;
+    case '*':
+    case '+':
+    case '?':
+      return !fail("quantifier does not follow a repeatable item");
+    case '\\':
+      return parse_escape(node);
+    default:
+      byte_node(node, (uint8_t)c);
+      return true;
+    }
+  }
+
+  bool parse_escape(Node& node)
+  {
+    if (at_end())
+      return !fail("\\ at end of pattern");
+    char e = m_pattern[m_pos++];
+
+    std::bitset<256> set;
+    if (add_perl_class(set, e))
+    {
+      class_node(node, set);
+      return true;
+    }
+    switch (e)
+    {
+    case 'b':
+      assert_node(node, NFAAssert::WordBoundary);
+      return true;
+    case 'B':
+      assert_node(node, NFAAssert::NotWordBoundary);
+      return true;
+    case 'A':
+      assert_node(node, NFAAssert::TextStart);
+      return true;
+    case 'z':
+      assert_node(node, NFAAssert::TextEnd);
+      return true;
+    default:
+      break;
+    }
+    if (e >= '1' && e <= '9')
+      return !fail("backreferences are not supported by the linear-time engine");
+
+    uint8_t c = 0;
+    if (!parse_escape_byte(e, c))
+      return !fail("unrecognized escape sequence");
+    byte_node(node, c);
+    return true;
+  }
+
+  bool parse_group(Node& node, int depth)
+  {
+    int capture = -1;
+    if (!at_end() && peek() == '?')
+    {
+      if (m_pos + 1 < m_pattern.size() && m_pattern[m_pos + 1] == ':')
+        m_pos += 2;
+      else
+        return !fail("only (?:...) groups are supported, lookaround is not linear time");
+    }
+    else
+    {
+      capture = ++m_captures;
+    }
+
+    Node inner;
+    if (!parse_alt(inner, depth + 1))
+      return false;
+    if (at_end() || peek() != ')')
+      return !fail("missing )");
+    ++m_pos;
+
+    node.kind    = Node::Group;
+    node.capture = capture;
+    node.children.push_back(std::move(inner));
+    return true;
+  }
+
+  bool parse_class(Node& node)
+  {
+    std::bitset<256> set;
+    bool             negate = false;
+    if (!at_end() && peek() == '^')
+    {
+      negate = true;
+      ++m_pos;
+    }
+
+    bool first = true;
+    for (;;)
+    {
+      if (at_end())
+        return !fail("missing terminating ] for character class");
+      char c = m_pattern[m_pos++];
+      if (c == ']' && !first)
+        break;
+      first = false;
+
+      if (c == '[' && !at_end() && peek() == ':')
+      {
+        auto close = m_pattern.find(":]", m_pos + 1);
+        if (close != std::string::npos)
+        {
+          auto name = m_pattern.substr(m_pos + 1, close - m_pos - 1);
+          if (!add_posix_class(set, name))
+            return !fail("unknown POSIX class name");
+          m_pos = close + 2;
+          continue;
+        }
+      }
+
+      uint8_t lo = (uint8_t)c;
+      if (c == '\\')
+      {
+        if (at_end())
+          return !fail("\\ at end of pattern");
+        char e = m_pattern[m_pos++];
+        if (add_perl_class(set, e))
+          continue;
+        if (e == 'b')
+          lo = '\b';
+        else if (!parse_escape_byte(e, lo))
+          return !fail("unrecognized escape sequence in character class");
+      }
+
+      // a range, unless the - is last in the class
+      if (m_pos + 1 < m_pattern.size() && peek() == '-' && m_pattern[m_pos + 1] != ']')
+      {
+        ++m_pos;
+        uint8_t hi = (uint8_t)m_pattern[m_pos++];
+        if (hi == '\\')
+        {
+          if (at_end() || !parse_escape_byte(m_pattern[m_pos++], hi))
+            return !fail("invalid range end in character class");
+        }
+        if (hi < lo)
+          return !fail("range out of order in character class");
+        add_range(set, lo, hi);
+        continue;
+      }
+      set.set(lo);
+    }
+
+    if (m_options & NFA_IGNORECASE)
+      fold_case(set);
+    if (negate)
+      set.flip();
+    class_node(node, set, false);
+    return true;
+  }
+
+  const std::string&             m_pattern;
+  uint32_t                       m_options;
+  std::vector<std::bitset<256>>& m_classes;
+  size_t                         m_pos      = 0;
+  int                            m_captures = 0;
+  const char*                    m_error    = "";
+};
+
+class Compiler
+{
+public:
+  Compiler(std::vector<NFAInst>& insts, uint32_t options) : m_insts(insts), m_options(options) {}
+
+  bool emit(const Node& node)
+  {
+    if (m_insts.size() > max_insts)
+      return false;
+
+    switch (node.kind)
+    {
+    case Node::Empty:
+      return true;
+    case Node::Byte:
+      push(NFAOp::Byte).byte = node.byte;
+      return true;
+    case Node::Class:
+      push(NFAOp::Class).x = node.cls;
+      return true;
+    case Node::Any:
+      push((m_options & NFA_DOTALL) ? NFAOp::Any : NFAOp::AnyNoNL);
+      return true;
+    case Node::Assert:
+      push(NFAOp::Assert).assertion = node.assertion;
+      return true;
+    case Node::Concat:
+      for (auto&& child : node.children)
+      {
+        if (!emit(child))
+          return false;
+      }
+      return true;
+    case Node::Group:
+      if (node.capture >= 0)
+        push(NFAOp::Save).x = 2 * node.capture;
+      if (!emit(node.children[0]))
+        return false;
+      if (node.capture >= 0)
+        push(NFAOp::Save).x = 2 * node.capture + 1;
+      return true;
+    case Node::Alt:
+      return emit_alt(node);
+    case Node::Repeat:
+      return emit_repeat(node);
+    }
+    return true;
+  }
+
+private:
+  NFAInst& push(NFAOp op)
+  {
+    m_insts.emplace_back();
+    m_insts.back().op = op;
+    return m_insts.back();
+  }
+
+  int pc() const { return (int)m_insts.size(); }
+
+  // push an instruction whose targets are patched later, returning its pc
+  int push_patch(NFAOp op)
+  {
+    push(op);
+    return pc() - 1;
+  }
+
+  // split to the next instruction and `other`, preferring the next one
+  // unless the repeat is lazy
+  void set_split(int at, int other, bool greedy)
+  {
+    m_insts[at].x = greedy ? at + 1 : other;
+    m_insts[at].y = greedy ? other : at + 1;
+  }
+
+  bool emit_alt(const Node& node)
+  {
+    std::vector<int> jumps;
+    for (size_t i = 0; i < node.children.size(); ++i)
+    {
+      int split = -1;
+      if (i + 1 < node.children.size())
+        split = push_patch(NFAOp::Split);
+      if (!emit(node.children[i]))
+        return false;
+      if (i + 1 < node.children.size())
+      {
+        jumps.push_back(push_patch(NFAOp::Jmp));
+        set_split(split, pc(), true);
+      }
+    }
+    for (int jump : jumps)
+      m_insts[jump].x = pc();
+    return true;
+  }
+
+  bool emit_repeat(const Node& node)
+  {
+    const Node& child = node.children[0];
+    for (int i = 0; i < node.min; ++i)
+    {
+      if (!emit(child))
+        return false;
+    }
+
+    if (node.max == -1)
+    {
+      // L: split body, out; body; jmp L
+      int loop = push_patch(NFAOp::Split);
+      if (!emit(child))
+        return false;
+      push(NFAOp::Jmp).x = loop;
+      set_split(loop, pc(), node.greedy);
+      return true;
+    }
+
+    // each optional copy can skip straight to the end
+    std::vector<int> splits;
+    for (int i = node.min; i < node.max; ++i)
+    {
+      splits.push_back(push_patch(NFAOp::Split));
+      if (!emit(child))
+        return false;
+    }
+    for (int split : splits)
+      set_split(split, pc(), node.greedy);
+    return true;
+  }
+
+  std::vector<NFAInst>& m_insts;
+  uint32_t              m_options;
+};
+
+bool
+consumes(const NFAInst& inst, uint8_t c, const std::vector<std::bitset<256>>& classes)
+{
+  switch (inst.op)
+  {
+  case NFAOp::Byte:
+    return inst.byte == c;
+  case NFAOp::Class:
+    return classes[inst.x][c];
+  case NFAOp::Any:
+    return true;
+  case NFAOp::AnyNoNL:
+    return c != '\n';
+  default:
+    return false;
+  }
+}
+}
+
+bool
+NFAProgram::compile(const std::string& pattern, uint32_t options, std::string& error)
+{
+  m_insts.clear();
+  m_classes.clear();
+
+  Node   root;
+  Parser parser(pattern, options, m_classes);
+  if (!parser.parse(root, error))
+    return false;
+  m_captures = parser.captures();
+
+  // whole match is group 0
+  Compiler compiler(m_insts, options);
+  m_insts.emplace_back();
+  m_insts.back().op = NFAOp::Save;
+  m_insts.back().x  = 0;
+  if (!compiler.emit(root) || m_insts.size() > max_insts)
+  {
+    error = "NFA compilation failed, pattern: '" + pattern + "': pattern is too large.";
+    return false;
+  }
+  m_insts.emplace_back();
+  m_insts.back().op = NFAOp::Save;
+  m_insts.back().x  = 1;
+  m_insts.emplace_back();
+  m_insts.back().op = NFAOp::Match;
+
+  // first bytes and nullability from the epsilon closure of the start,
+  // treating assertions as passable
+  m_first.reset();
+  m_nullable = false;
+  std::vector<bool> seen(m_insts.size());
+  std::vector<int>  stack = { 0 };
+  while (!stack.empty())
+  {
+    int pc = stack.back();
+    stack.pop_back();
+    if (seen[pc])
+      continue;
+    seen[pc]            = true;
+    const NFAInst& inst = m_insts[pc];
+    switch (inst.op)
+    {
+    case NFAOp::Split:
+      stack.push_back(inst.y);
+      stack.push_back(inst.x);
+      break;
+    case NFAOp::Jmp:
+      stack.push_back(inst.x);
+      break;
+    case NFAOp::Save:
+    case NFAOp::Assert:
+      stack.push_back(pc + 1);
+      break;
+    case NFAOp::Match:
+      m_nullable = true;
+      break;
+    default:
+      for (int c = 0; c < 256; ++c)
+      {
+        if (consumes(inst, (uint8_t)c, m_classes))
+          m_first.set(c);
+      }
+      break;
+    }
+  }
+  return true;
+}
+
+size_t
+NFAProgram::memory() const
+{
+  return sizeof(NFAProgram) + m_insts.capacity() * sizeof(NFAInst) + m_classes.capacity() * sizeof(std::bitset<256>);
+}
+
+size_t
+NFAMatcher::memory() const
+{
+  size_t bytes = sizeof(NFAMatcher);
+  for (const ThreadList* list : { &m_clist, &m_nlist })
+    bytes += (list->dense.capacity() + list->sparse.capacity()) * sizeof(int) + list->caps.capacity() * sizeof(size_t);
+  return bytes + (m_scratch.capacity() + m_best.capacity()) * sizeof(size_t) + m_stack.capacity() * sizeof(Frame);
+}
+
+NFAMatcher::NFAMatcher(const NFAProgram& prog) : m_prog(prog), m_slots(2 * (prog.m_captures + 1))
+{
+  size_t n = prog.m_insts.size();
+  for (ThreadList* list : { &m_clist, &m_nlist })
+  {
+    list->dense.resize(n);
+    list->sparse.resize(n);
+    list->caps.resize(n * m_slots);
+  }
+  m_scratch.resize(m_slots);
+  m_best.resize(m_slots, SIZE_MAX);
+}
+
+bool
+NFAMatcher::check(NFAAssert assertion, size_t pos) const
+{
+  switch (assertion)
+  {
+  case NFAAssert::LineStart:
+    return pos == 0 || m_subject[pos - 1] == '\n';
+  case NFAAssert::LineEnd:
+    return pos == m_length || m_subject[pos] == '\n';
+  case NFAAssert::TextStart:
+    return pos == 0;
+  case NFAAssert::TextEnd:
+    return pos == m_length;
+  case NFAAssert::WordBoundary:
+  case NFAAssert::NotWordBoundary:
+  {
+    bool before   = pos > 0 && is_word((uint8_t)m_subject[pos - 1]);
+    bool after    = pos < m_length && is_word((uint8_t)m_subject[pos]);
+    bool boundary = before != after;
+    return assertion == NFAAssert::WordBoundary ? boundary : !boundary;
+  }
+  }
+  return false;
+}
+
+// Add the thread at pc and everything reachable from it without consuming
+// input, in priority order. An explicit stack replaces recursion, with Save
+// pushing a frame that restores the slot once that branch is done.
+void
+NFAMatcher::add(ThreadList& list, int pc, size_t pos, size_t* caps)
+{
+  m_stack.clear();
+  m_stack.push_back({ pc, -1, 0 });
+  while (!m_stack.empty())
+  {
+    Frame frame = m_stack.back();
+    m_stack.pop_back();
+    if (frame.slot >= 0)
+    {
+      caps[frame.slot] = frame.value;
+      continue;
+    }
+
+    pc = frame.pc;
+    for (;;)
+    {
+      if (list.contains(pc))
+        break;
+      list.insert(pc);
+      const NFAInst& inst = m_prog.m_insts[pc];
+      switch (inst.op)
+      {
+      case NFAOp::Jmp:
+        pc = inst.x;
+        continue;
+      case NFAOp::Split:
+        m_stack.push_back({ inst.y, -1, 0 });
+        pc = inst.x;
+        continue;
+      case NFAOp::Save:
+        m_stack.push_back({ 0, inst.x, caps[inst.x] });
+        caps[inst.x] = pos;
+        ++pc;
+        continue;
+      case NFAOp::Assert:
+        if (!check(inst.assertion, pos))
+          break;
+        ++pc;
+        continue;
+      default:
+        std::copy(caps, caps + m_slots, list.caps.begin() + pc * m_slots);
+        break;
+      }
+      break;
+    }
+  }
+}
+
+bool
+NFAMatcher::search(const char* subject, size_t length, size_t start, bool nonempty_at_start)
+{
+  m_subject = subject;
+  m_length  = length;
+  m_clist.n = 0;
+  std::fill(m_best.begin(), m_best.end(), SIZE_MAX);
+  if (start > length)
+    return false;
+
+  const auto& insts   = m_prog.m_insts;
+  const auto& first   = m_prog.m_first;
+  bool        matched = false;
+  for (size_t i = start;; ++i)
+  {
+    if (!matched && (!nonempty_at_start || i == start))
+    {
+      // with no live threads, skip bytes that cannot start a match
+      if (m_clist.n == 0 && !m_prog.m_nullable && !nonempty_at_start)
+      {
+        while (i < length && !first[(uint8_t)subject[i]])
+          ++i;
+        if (i >= length)
+          break;
+      }
+      std::fill(m_scratch.begin(), m_scratch.end(), SIZE_MAX);
+      add(m_clist, 0, i, m_scratch.data());
+    }
+    if (m_clist.n == 0)
+      break;
+
+    m_nlist.n = 0;
+    for (size_t t = 0; t < m_clist.n; ++t)
+    {
+      int            pc   = m_clist.dense[t];
+      const NFAInst& inst = insts[pc];
+      const size_t*  caps = m_clist.caps.data() + pc * m_slots;
+      if (inst.op == NFAOp::Match)
+      {
+        // an empty match here gives way to the threads still consuming
+        if (nonempty_at_start && i == start)
+          continue;
+        // lower priority threads can no longer win
+        std::copy(caps, caps + m_slots, m_best.begin());
+        matched = true;
+        break;
+      }
+      if (i < length && consumes(inst, (uint8_t)subject[i], m_prog.m_classes))
+      {
+        std::copy(caps, caps + m_slots, m_scratch.begin());
+        add(m_nlist, pc + 1, i + 1, m_scratch.data());
+      }
+    }
+    std::swap(m_clist, m_nlist);
+    if (i >= length)
+      break;
+  }
+  return matched;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A small linear-time regex engine. Patterns are compiled to a Thompson NFA
+// and run by a Pike VM, which advances every live thread one byte at a time,
+// so a search is O(pattern size x text length) and never backtracks.
+//
+// Syntax is POSIX ERE with the common Perl escapes:
+//   literals, ., [...] with ranges, negation and [:alpha:] style classes,
+//   \d \w \s \D \W \S, ^ $ \A \z \b \B, (...), (?:...), |,
+//   * + ? {n} {n,} {n,m} and their lazy forms *? +? ?? {n,m}?
+// Backreferences and lookaround are rejected, since they cannot be matched
+// in linear time. Matching is byte-oriented and leftmost-first, like PCRE2.
+
+enum NFAOption : uint32_t
+{
+  NFA_IGNORECASE = 1 << 0, // ASCII case-insensitive
+  NFA_MULTILINE  = 1 << 1, // ^ and $ also match at newlines
+  NFA_DOTALL     = 1 << 2, // . also matches newline
+};
+
+enum class NFAOp : uint8_t
+{
+  Byte,    // match `byte`
+  Class,   // match a byte in classes[x]
+  Any,     // match any byte
+  AnyNoNL, // match any byte but newline
+  Split,   // fork to x (preferred) and y
+  Jmp,     // continue at x
+  Save,    // record the position in capture slot x
+  Assert,  // zero-width check of `assertion`
+  Match,
+};
+
+enum class NFAAssert : uint8_t
+{
+  LineStart,
+  LineEnd,
+  TextStart,
+  TextEnd,
+  WordBoundary,
+  NotWordBoundary,
+};
+
+struct NFAInst
+{
+  NFAOp     op        = NFAOp::Match;
+  uint8_t   byte      = 0;
+  NFAAssert assertion = NFAAssert::TextStart;
+  int       x         = 0;
+  int       y         = 0;
+};
+
+class NFAProgram
+{
+public:
+  // Compile pattern with NFA_* options. Returns false with a message in error.
+  bool compile(const std::string& pattern, uint32_t options, std::string& error);
+
+  int    captures() const { return m_captures; }
+  size_t size() const { return m_insts.size(); }
+  size_t memory() const;
+
+private:
+  friend class NFAMatcher;
+
+  std::vector<NFAInst>          m_insts;
+  std::vector<std::bitset<256>> m_classes;
+  std::bitset<256>              m_first;            // bytes that can start a match
+  bool                          m_nullable = false; // can match the empty string
+  int                           m_captures = 0;
+};
+
+// Runs searches over one program. The thread lists and capture buffers are
+// kept between calls, so walking every match of a subject allocates once.
+class NFAMatcher
+{
+public:
+  explicit NFAMatcher(const NFAProgram& prog);
+
+  // Find the leftmost-first match at or after start. With nonempty_at
+  // start, only a non-empty match beginning at start counts, as PCRE2 tries
+  // after an empty match with PCRE2_NOTEMPTY_ATSTART | PCRE2_ANCHORED.
+  bool search(const char* subject, size_t length, size_t start, bool nonempty_at_start = false);
+
+  // begin/end pairs for the match and each group, SIZE_MAX when unset.
+  const size_t* spans() const { return m_best.data(); }
+  int           count() const { return m_prog.m_captures + 1; }
+
+  // Bytes held by the thread lists and buffers, as grown so far.
+  size_t memory() const;
+
+private:
+  struct ThreadList
+  {
+    std::vector<int>    dense;  // pcs in priority order
+    std::vector<int>    sparse; // pc -> index into dense
+    std::vector<size_t> caps;   // capture slots for each pc
+    size_t              n = 0;
+
+    bool contains(int pc) const { return sparse[pc] < (int)n && dense[sparse[pc]] == pc; }
+    void insert(int pc)
+    {
+      sparse[pc] = (int)n;
+      dense[n++] = pc;
+    }
+  };
+
+  struct Frame
+  {
+    int    pc;
+    int    slot; // >= 0 restores caps[slot] to value instead of exploring pc
+    size_t value;
+  };
+
+  void add(ThreadList& list, int pc, size_t pos, size_t* caps);
+  bool check(NFAAssert assertion, size_t pos) const;
+
+  const NFAProgram&   m_prog;
+  size_t              m_slots;
+  ThreadList          m_clist;
+  ThreadList          m_nlist;
+  std::vector<size_t> m_scratch;
+  std::vector<size_t> m_best;
+  std::vector<Frame>  m_stack;
+  const char*         m_subject = nullptr;
+  size_t              m_length  = 0;
+};
@@ -0,0 +1,170 @@
+#include "pool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+// before each block; class sizes are multiples of it, so blocks carved
+// from a slab stay aligned for any type
+const size_t header = 16;
+static_assert(header % alignof(std::max_align_t) == 0, "pool blocks must be aligned for any type");
+
+const size_t   min_block    = 32;
+const size_t   max_block    = 64 * 1024;
+const size_t   slab_size    = 256 * 1024;
+const uint32_t system_class = UINT32_MAX; // allocated with malloc
+
+// The class of a block of n bytes, header included, n <= max_block. Past 32
+// bytes, n falls in (2^p, 2^(p+1)], which is split in four steps of 2^(p-2),
+// rounded up to the header size: between 32 and 64 that makes the 40 and 56
+// byte classes the same size as the 48 and 64 byte ones.
+inline uint32_t
+size_class(size_t n)
+{
+  if (n <= min_block)
+    return 0;
+  int p = 5;
+  while (((size_t)1 << (p + 1)) < n)
+    ++p;
+  size_t slot = (n - 1) >> (p - 2); // 4 to 7
+  return (uint32_t)((p - 5) * 4 + (slot - 4) + 1);
+}
+
+inline size_t
+class_size(uint32_t c)
+{
+  if (c == 0)
+    return min_block;
+  size_t p    = 5 + (c - 1) / 4;
+  size_t slot = 4 + (c - 1) % 4;
+  return (((slot + 1) << (p - 2)) + header - 1) & ~(header - 1);
+}
+
+inline uint32_t&
+class_of(void* block)
+{
+  return *(uint32_t*)block;
+}
+}
+
+// A block of each class this thread released last, for the pool that owns
+// them; handed back to that pool when the thread exits.
+struct ThreadCache
+{
+  SizeClassPool* owner = nullptr;
+  void*          blocks[SizeClassPool::classes] = {};
+
+  ~ThreadCache()
+  {
+    for (uint32_t c = 0; c < SizeClassPool::classes; ++c)
+    {
+      if (blocks[c])
+        owner->give(c, blocks[c]);
+    }
+  }
+};
+
+namespace
+{
+thread_local ThreadCache thread_cache;
+}
+
+SizeClassPool::SizeClassPool()
+{
+  const char* setting = getenv("JRE_PCRE2_POOL");
+  m_enabled           = !(setting && strcmp(setting, "off") == 0);
+}
+
+void*
+SizeClassPool::allocate(size_t size)
+{
+  if (!m_enabled || size > max_block - header)
+  {
+    void* block = malloc(size + header);
+    if (!block)
+      return nullptr;
+    class_of(block) = system_class;
+    return (char*)block + header;
+  }
+
+  uint32_t c     = size_class(size + header);
+  void*    block = nullptr;
+  if (thread_cache.owner == this && thread_cache.blocks[c])
+    std::swap(block, thread_cache.blocks[c]);
+  else
+    block = take(c);
+  if (!block)
+    return nullptr;
+  m_in_use += class_size(c);
+  class_of(block) = c;
+  return (char*)block + header;
+}
+
+void
+SizeClassPool::release(void* memory)
+{
+  if (!memory)
+    return;
+  void*    block = (char*)memory - header;
+  uint32_t c     = class_of(block);
+  if (c == system_class)
+  {
+    free(block);
+    return;
+  }
+  m_in_use -= class_size(c);
+  // the cache holds blocks of one pool, the first to release on the thread
+  if (!thread_cache.owner)
+    thread_cache.owner = this;
+  if (thread_cache.owner == this && !thread_cache.blocks[c])
+    thread_cache.blocks[c] = block;
+  else
+    give(c, block);
+}
+
+void*
+SizeClassPool::take(uint32_t c)
+{
+  size_t                      bytes = class_size(c);
+  Class&                      klass = m_classes[c];
+  std::lock_guard<std::mutex> guard(klass.lock);
+  if (klass.free)
+  {
+    void* block = klass.free;
+    klass.free  = *(void**)block;
+    return block;
+  }
+  if ((size_t)(klass.end - klass.carve) < bytes)
+  {
+    // the tail of the old slab, less than one block, is left unused
+    size_t slab = std::max(slab_size, bytes);
+    char*  from = (char*)malloc(slab);
+    if (!from)
+      return nullptr;
+    m_reserved += slab;
+    klass.carve = from;
+    klass.end   = from + slab;
+  }
+  void* block = klass.carve;
+  klass.carve += bytes;
+  return block;
+}
+
+void
+SizeClassPool::give(uint32_t c, void* block)
+{
+  Class&                      klass = m_classes[c];
+  std::lock_guard<std::mutex> guard(klass.lock);
+  *(void**)block = klass.free;
+  klass.free     = block;
+}
+
+SizeClassPool&
+pcre2_pool()
+{
+  static SizeClassPool* pool = new SizeClassPool();
+  return *pool;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+// A size-class allocator for PCRE2's own allocations: compiled code, match
+// data, match contexts and the heap frames pcre2_match grows. Those come and
+// go in a handful of sizes as regexes are compiled and collected, and in a
+// long-lived process interleaving them with everything else on the system
+// heap leaves it fragmented. Here each size class carves its blocks from
+// slabs of its own and keeps freed blocks for the next allocation of that
+// class, so the memory held stays at the peak in use rather than creeping.
+//
+// Classes step by a quarter of a power of two up to 64 KB; larger blocks go
+// to malloc. Each block starts with a header naming its class, so a block
+// can be released without its size, from any thread. Every thread keeps the
+// last block it released of each class, which its next allocation of that
+// class takes without locking: a match creating its match data and heap
+// frames and freeing them again touches no lock. Setting the environment
+// variable JRE_PCRE2_POOL to "off" sends every allocation to malloc, to
+// compare the two.
+
+// A pool must outlive every thread that releases blocks to it.
+class SizeClassPool
+{
+public:
+  SizeClassPool();
+
+  SizeClassPool(const SizeClassPool&)            = delete;
+  SizeClassPool& operator=(const SizeClassPool&) = delete;
+
+  // Null when the system is out of memory, as PCRE2 expects.
+  void* allocate(size_t size);
+  void  release(void* block);
+
+  // Bytes of slabs taken from the system, and of blocks handed out from them.
+  size_t reserved() const { return m_reserved; }
+  size_t in_use() const { return m_in_use; }
+
+  static const uint32_t classes = 45;
+
+private:
+  friend struct ThreadCache;
+
+  void* take(uint32_t c);
+  void  give(uint32_t c, void* block);
+
+  struct Class
+  {
+    std::mutex lock;
+    void*      free  = nullptr; // freed blocks, linked through their first word
+    char*      carve = nullptr; // the rest of the newest slab
+    char*      end   = nullptr;
+  };
+
+  bool                m_enabled = true;
+  Class               m_classes[classes];
+  std::atomic<size_t> m_reserved{ 0 };
+  std::atomic<size_t> m_in_use{ 0 };
+};
+
+// The pool behind PCRE2's general context. It lives for the process, since
+// regexes may still be collected while the process exits.
+SizeClassPool& pcre2_pool();
@@ -0,0 +1,272 @@
+#include "prefilter.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+const size_t min_literal = 2;
+
+inline unsigned char
+lower(unsigned char c)
+{
+  return c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+}
+
+// Escapes that match one character of a class, or a position, so they end
+// a run.
+const char* class_escapes = "dDwWsShHvVntrfae";
+const char* zero_escapes  = "bBAzZ";
+
+// Skip the class starting at p, which points at '['. Returns the closing ']',
+// or null if the class is not closed.
+const char*
+skip_class(const char* p)
+{
+  ++p;
+  if (*p == '^')
+    ++p;
+  if (*p == ']')
+    ++p;
+  for (; *p && *p != ']'; ++p)
+  {
+    if (*p == '\\' && p[1])
+      ++p;
+    else if (p[0] == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '='))
+    {
+      const char* close = strstr(p + 2, p[1] == ':' ? ":]" : p[1] == '.' ? ".]" : "=]");
+      if (!close)
+        return nullptr;
+      p = close + 1;
+    }
+  }
+  return *p ? p : nullptr;
+}
+
+// Rough commonness of a lowered byte in text, higher is more common. The
+// scan tests the two least common bytes of the needle, so it stops less
+// often on false candidates.
+int
+frequency(unsigned char c)
+{
+  if (c == ' ')
+    return 3;
+  if (strchr("etaoinsrhl", c))
+    return 2;
+  if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9'))
+    return 1;
+  return 0;
+}
+
+bool
+equal_caseless(const char* text, const std::string& needle)
+{
+  for (size_t i = 0; i < needle.size(); ++i)
+  {
+    if (lower((unsigned char)text[i]) != (unsigned char)needle[i])
+      return false;
+  }
+  return true;
+}
+}
+
+CaselessPrefilter*
+caseless_prefilter(const char* pattern, bool utf)
+{
+  std::string best;
+  std::string run;
+  size_t      best_lead = 0;
+  size_t      run_lead  = 0;
+  size_t      width     = 0; // most bytes matched so far at the top level, SIZE_MAX once unbounded
+  size_t      one       = utf ? 4 : 1;
+  int         depth     = 0;
+  auto        end       = [&]() {
+    if (run.size() > best.size())
+    {
+      best      = run;
+      best_lead = run_lead;
+    }
+    run.clear();
+  };
+  auto add = [&](size_t n) {
+    if (width != SIZE_MAX)
+      width += n;
+  };
+
+  for (const char* p = pattern; *p; ++p)
+  {
+    unsigned char c = (unsigned char)*p;
+    switch (c)
+    {
+    case '(':
+      // verbs, comments and inline options such as (?x) change what the
+      // rest of the pattern means
+      if (p[1] == '*' || (p[1] == '?' && (p[2] == '#' || p[2] == '-' || p[2] == '^' ||
+                                           (((p[2] | 0x20) >= 'a' && (p[2] | 0x20) <= 'z') && p[2] != 'P'))))
+        return nullptr;
+      end();
+      ++depth;
+      width = SIZE_MAX;
+      continue;
+    case ')':
+      end();
+      depth = depth > 0 ? depth - 1 : 0;
+      continue;
+    case '|':
+      if (depth == 0)
+        return nullptr;
+      continue;
+    case '[':
+      end();
+      add(one);
+      p = skip_class(p);
+      if (!p)
+        return nullptr;
+      continue;
+    case '{':
+      if (!run.empty())
+        run.pop_back();
+      end();
+      width = SIZE_MAX;
+      // only a {n,m} count is followed, anything else may be literal text
+      for (++p; (*p >= '0' && *p <= '9') || *p == ','; ++p)
+        ;
+      if (*p != '}')
+        return nullptr;
+      continue;
+    case '*':
+    case '?':
+      // the atom before is optional
+      if (!run.empty())
+        run.pop_back();
+      end();
+      if (c == '*')
+        width = SIZE_MAX;
+      continue;
+    case '+':
+      end();
+      width = SIZE_MAX;
+      continue;
+    case '.':
+      end();
+      add(one);
+      continue;
+    case '^':
+    case '$':
+      end();
+      continue;
+    case '\\':
+      c = (unsigned char)p[1];
+      if (!c)
+        return nullptr;
+      ++p;
+      if ((c | 0x20) >= 'a' && (c | 0x20) <= 'z')
+      {
+        // \x, \p, \Q, \K, \G and others that take arguments or move the match
+        if (strchr(zero_escapes, c))
+        {
+          end();
+          continue;
+        }
+        if (!strchr(class_escapes, c))
+          return nullptr;
+        end();
+        add(one);
+        continue;
+      }
+      if (c >= '0' && c <= '9')
+        return nullptr; // backreferences and octal escapes
+      break;
+    default:
+      break;
+    }
+
+    // literal c, only counted outside groups, which may be optional
+    if (depth > 0)
+      continue;
+    if (c < 0x20 || c > 0x7e || (utf && (lower(c) == 'k' || lower(c) == 's')))
+      end();
+    else
+    {
+      if (run.empty())
+        run_lead = width;
+      run.push_back((char)lower(c));
+    }
+    add(1);
+  }
+  end();
+
+  if (best.size() < min_literal)
+    return nullptr;
+  auto* prefilter    = new CaselessPrefilter();
+  prefilter->literal = best;
+  prefilter->lead    = best_lead;
+  // probe the least common byte and the one least common and furthest from
+  // it, since neighbouring bytes tend to come in common pairs
+  size_t* probes = prefilter->probes;
+  auto    rank   = [&](size_t k) { return frequency((unsigned char)best[k]); };
+  auto    apart  = [&](size_t k) { return k > probes[0] ? k - probes[0] : probes[0] - k; };
+  probes[0]      = 0;
+  for (size_t k = 1; k < best.size(); ++k)
+  {
+    if (rank(k) < rank(probes[0]))
+      probes[0] = k;
+  }
+  probes[1] = probes[0] == 0 ? 1 : 0;
+  for (size_t k = 0; k < best.size(); ++k)
+  {
+    if (k != probes[0] && (rank(k) < rank(probes[1]) || (rank(k) == rank(probes[1]) && apart(k) > apart(probes[1]))))
+      probes[1] = k;
+  }
+  return prefilter;
+}
+
+size_t
+find_caseless(const char* subject, size_t length, size_t from, const CaselessPrefilter& prefilter)
+{
+  const std::string& needle = prefilter.literal;
+  size_t             n      = needle.size();
+  if (from > length || length - from < n)
+    return SIZE_MAX;
+
+  // Compare the two probe bytes at every position, both sides with 0x20 set
+  // so letters match either case. Other bytes can pass this too, so
+  // candidates are confirmed with a full comparison.
+  const size_t  last_start = length - n;
+  const size_t  p0         = prefilter.probes[0];
+  const size_t  p1         = prefilter.probes[1];
+  unsigned char b0         = (unsigned char)needle[p0] | 0x20;
+  unsigned char b1         = (unsigned char)needle[p1] | 0x20;
+  size_t        i          = from;
+
+#if defined(__SSE2__)
+  const __m128i fold = _mm_set1_epi8(0x20);
+  const __m128i v0   = _mm_set1_epi8((char)b0);
+  const __m128i v1   = _mm_set1_epi8((char)b1);
+  for (; i + 16 <= last_start + 1; i += 16)
+  {
+    __m128i  a    = _mm_or_si128(_mm_loadu_si128((const __m128i*)(subject + i + p0)), fold);
+    __m128i  b    = _mm_or_si128(_mm_loadu_si128((const __m128i*)(subject + i + p1)), fold);
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, v0), _mm_cmpeq_epi8(b, v1)));
+    while (mask)
+    {
+      unsigned bit = (unsigned)__builtin_ctz(mask);
+      if (equal_caseless(subject + i + bit, needle))
+        return i + bit;
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  for (; i <= last_start; ++i)
+  {
+    if (((unsigned char)subject[i + p0] | 0x20) == b0 && ((unsigned char)subject[i + p1] | 0x20) == b1 &&
+        equal_caseless(subject + i, needle))
+      return i;
+  }
+  return SIZE_MAX;
+}
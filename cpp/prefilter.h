@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// A quick rejection test for :ignorecase patterns. Case-insensitive
+// matching is slow in every engine, but most such patterns contain a run of
+// plain ASCII text that any match must include, e.g. "error" in
+// "error: (\w+)". Searching for that run with a case-folded scan is much
+// cheaper than running the engine: a subject without it cannot match, and
+// when the text before it in the pattern has a bounded length, no match can
+// start further back than that from where it occurs.
+
+struct CaselessPrefilter
+{
+  std::string literal;              // lowered
+  size_t      lead      = SIZE_MAX; // most bytes a match has before literal, SIZE_MAX if unbounded
+  size_t      probes[2] = { 0, 1 }; // offsets of the literal's least common bytes, tested first
+};
+
+// The longest run of literal ASCII text that every match of pattern must
+// contain, or null if there is none of at least two bytes or the pattern
+// uses syntax the scan does not follow (alternation at the top level,
+// inline options, \Q...\E and the like). With utf, k and s are left out
+// since they also fold to non-ASCII characters.
+CaselessPrefilter* caseless_prefilter(const char* pattern, bool utf);
+
+// Offset of the first case-insensitive occurrence of the prefilter's literal
+// in subject at or after from, or SIZE_MAX.
+size_t find_caseless(const char* subject, size_t length, size_t from, const CaselessPrefilter& prefilter);
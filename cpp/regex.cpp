@@ -0,0 +1,842 @@
+#include "regex.h"
+
+#include "wrap_literals.h"
+#include "wrap_nfa.h"
+#include "wrap_pcre2.h"
+#include "wrap_std_regex.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <sstream>
+
+namespace
+{
+// Runs the engine only while the prefilter text occurs in the rest of the
+// subject. Every match lies at or after the end of the previous one, so one
+// occurrence found there serves each search until a match passes it. When
+// the pattern bounds how far before the text a match can start, the engine
+// is restarted there rather than searching the bytes in between.
+class PrefilterMatcher : public RegexMatcher
+{
+public:
+  PrefilterMatcher(RegexMatcherPtr inner, const CaselessPrefilter& prefilter)
+    : m_inner(std::move(inner)), m_prefilter(prefilter)
+  {
+  }
+
+  void
+  reset(const char* subject, size_t length, size_t start) override
+  {
+    m_inner->reset(subject, length, start);
+    m_subject = subject;
+    m_length  = length;
+    m_from    = start;
+    m_found   = SIZE_MAX;
+    m_done    = false;
+  }
+
+  bool
+  next() override
+  {
+    if (m_done)
+      return false;
+    if (m_found == SIZE_MAX || m_found < m_from)
+      m_found = find_caseless(m_subject, m_length, m_from, m_prefilter);
+    if (m_found == SIZE_MAX)
+    {
+      m_done = true;
+      return false;
+    }
+    if (m_prefilter.lead != SIZE_MAX && m_found - m_from > m_prefilter.lead)
+    {
+      m_from = m_found - m_prefilter.lead;
+      m_inner->reset(m_subject, m_length, m_from);
+    }
+    if (!m_inner->next())
+    {
+      m_done = true;
+      return false;
+    }
+    m_from = m_inner->spans()[1];
+    return true;
+  }
+
+  const size_t*
+  spans() const override
+  {
+    return m_inner->spans();
+  }
+
+  int
+  count() const override
+  {
+    return m_inner->count();
+  }
+
+  std::string
+  error() const override
+  {
+    return m_inner->error();
+  }
+
+private:
+  RegexMatcherPtr          m_inner;
+  const CaselessPrefilter& m_prefilter;
+  const char*              m_subject = nullptr;
+  size_t                   m_length  = 0;
+  size_t                   m_from    = 0; // no match starts before this
+  size_t                   m_found   = SIZE_MAX;
+  bool                     m_done    = false;
+};
+
+// Append the match and its set groups, groups that matched the empty
+// string are kept.
+void
+push_match(const JanetRegex* regex, const size_t* spans, int count, MatchResults& results)
+{
+  results.starts.push_back(results.spans.size());
+  results.spans.push_back({ spans[0], spans[1], 0, nullptr });
+  for (int i = 1; i < count; ++i)
+  {
+    if (spans[2 * i] == SIZE_MAX)
+      continue;
+    const std::string* name = regex->engine->group_name ? regex->engine->group_name(regex, i) : nullptr;
+    results.spans.push_back({ spans[2 * i], spans[2 * i + 1], i, name });
+  }
+}
+
+const RegexEngine* regex_engines[] = { &pcre2_engine, &std_engine, &nfa_engine, &literals_engine };
+
+// regexes from every Janet thread
+std::atomic<size_t> live_regexes{ 0 };
+std::atomic<size_t> live_bytes{ 0 };
+
+void
+marshal_string(JanetMarshalContext* ctx, const std::string& value)
+{
+  janet_marshal_size(ctx, value.size());
+  janet_marshal_bytes(ctx, (const uint8_t*)value.data(), value.size());
+}
+
+std::string
+unmarshal_string(JanetMarshalContext* ctx)
+{
+  std::string value(janet_unmarshal_size(ctx), '\0');
+  janet_unmarshal_bytes(ctx, (uint8_t*)&value[0], value.size());
+  return value;
+}
+
+// Bytes at the end of the subject jre/find-last searches first, doubled
+// each time the window before it holds no match.
+const size_t last_window = 256;
+
+// Whether matches start only on UTF-8 character boundaries, which PCRE2
+// also requires of the start offset.
+bool
+utf_starts(const JanetRegex* regex)
+{
+  if (regex->engine != &pcre2_engine)
+    return false;
+  uint32_t options = 0;
+  (void)pcre2_pattern_info(static_cast<const JanetPCRE2Regex*>(regex)->re, PCRE2_INFO_ALLOPTIONS, &options);
+  return (options & PCRE2_UTF) != 0;
+}
+
+// Number of the group called name, or -1 if no group or more than one has it.
+int
+group_number(const JanetRegex* regex, const std::string& name)
+{
+  int number   = -1;
+  int captures = regex->engine->captures(regex);
+  for (int i = 1; i <= captures; ++i)
+  {
+    const std::string* group = regex->engine->group_name(regex, i);
+    if (!group || *group != name)
+      continue;
+    if (number >= 0)
+      return -1;
+    number = i;
+  }
+  return number;
+}
+}
+
+JanetAbstractType regex_type = {};
+
+void
+initialize_regex_type()
+{
+  if (!regex_type.name)
+  {
+    regex_type.name      = "jre";
+    regex_type.gc        = regex_gc;
+    regex_type.marshal   = regex_marshal;
+    regex_type.unmarshal = regex_unmarshal;
+    regex_type.tostring  = regex_tostring;
+  }
+}
+
+int
+regex_gc(void* data, size_t len)
+{
+  (void)len;
+  if (data)
+  {
+    JanetRegex* re = (JanetRegex*)data;
+    if (re->memory)
+    {
+      --live_regexes;
+      live_bytes -= re->memory;
+      re->memory = 0;
+    }
+    if (re->engine)
+      re->engine->release(re);
+    if (re->pattern)
+    {
+      delete (re->pattern);
+      re->pattern = nullptr;
+    }
+    if (re->flags)
+    {
+      delete (re->flags);
+      re->flags = nullptr;
+    }
+    if (re->prefilter)
+    {
+      delete (re->prefilter);
+      re->prefilter = nullptr;
+    }
+  }
+  return 0;
+}
+
+void
+regex_tostring(void* data, JanetBuffer* buffer)
+{
+  if (data)
+  {
+    JanetRegex* re = (JanetRegex*)data;
+    if (!re->pattern)
+    {
+      janet_buffer_push_cstring(buffer, "no pattern");
+      return;
+    }
+    janet_buffer_push_cstring(buffer, re->engine->name);
+    janet_buffer_push_cstring(buffer, " pattern: '");
+    janet_buffer_push_cstring(buffer, re->pattern->c_str());
+    janet_buffer_push_cstring(buffer, "' flags: (");
+    for (size_t i = 0; re->flags && i < re->flags->size(); ++i)
+    {
+      if (i > 0)
+        janet_buffer_push_cstring(buffer, " ");
+      janet_buffer_push_cstring(buffer, ":");
+      janet_buffer_push_cstring(buffer, re->flags->at(i).c_str());
+    }
+    janet_buffer_push_cstring(buffer, ")");
+  }
+}
+
+void
+regex_marshal(void* data, JanetMarshalContext* ctx)
+{
+  JanetRegex* re = (JanetRegex*)data;
+  // the engine comes first, unmarshal needs it to size the abstract
+  marshal_string(ctx, re->engine->name);
+  janet_marshal_abstract(ctx, data);
+  marshal_string(ctx, *re->pattern);
+  janet_marshal_size(ctx, re->flags->size());
+  for (auto&& flag : *re->flags)
+    marshal_string(ctx, flag);
+  marshal_string(ctx, re->engine->serialize ? re->engine->serialize(re) : std::string());
+}
+
+void*
+regex_unmarshal(JanetMarshalContext* ctx)
+{
+  const RegexEngine* engine = nullptr;
+  {
+    std::string name = unmarshal_string(ctx);
+    engine           = get_regex_engine(janet_ckeywordv(name.c_str()));
+  }
+  if (!engine)
+    janet_panic("unknown regex engine in marshalled regex");
+
+  JanetRegex* regex = (JanetRegex*)janet_unmarshal_abstract(ctx, engine->size);
+  memset((void*)regex, 0, engine->size);
+  Janet message = janet_wrap_nil();
+  {
+    // scoped so no C++ strings are live at the panic below
+    std::string        pattern = unmarshal_string(ctx);
+    size_t             count   = janet_unmarshal_size(ctx);
+    std::vector<Janet> flags;
+    for (size_t i = 0; i < count; ++i)
+      flags.push_back(janet_ckeywordv(unmarshal_string(ctx).c_str()));
+    std::string serialized = unmarshal_string(ctx);
+    if (!engine->restore(regex, pattern.c_str(), flags.data(), (int32_t)flags.size(), serialized))
+      message = janet_cstringv(regex->pattern->c_str());
+  }
+  if (!janet_checktype(message, JANET_NIL))
+    janet_panicv(message);
+  regex_account(regex);
+  janet_gcpressure(regex->memory);
+  return regex;
+}
+
+const RegexEngine*
+get_regex_engine(Janet name)
+{
+  for (auto* engine : regex_engines)
+  {
+    if (janet_checktype(name, JANET_KEYWORD) && janet_unwrap_keyword(name) == janet_ckeyword(engine->name))
+      return engine;
+  }
+  return nullptr;
+}
+
+JanetRegex*
+regex_compiled(JanetRegex* regex, bool ok, std::string& error)
+{
+  if (ok)
+  {
+    regex_account(regex);
+    return regex;
+  }
+  error = regex->pattern ? *regex->pattern : "unknown compile error";
+  regex_gc(regex, 0);
+  return nullptr;
+}
+
+size_t
+regex_memory(const JanetRegex* regex)
+{
+  size_t bytes = regex->engine->memory(regex);
+  if (regex->pattern)
+    bytes += sizeof(std::string) + regex->pattern->size();
+  if (regex->flags)
+  {
+    bytes += sizeof(std::vector<std::string>) + regex->flags->size() * sizeof(std::string);
+    for (auto&& flag : *regex->flags)
+      bytes += flag.size();
+  }
+  if (regex->prefilter)
+    bytes += sizeof(CaselessPrefilter) + regex->prefilter->literal.size();
+  return bytes;
+}
+
+void
+regex_account(JanetRegex* regex)
+{
+  regex->memory = regex_memory(regex);
+  ++live_regexes;
+  live_bytes += regex->memory;
+}
+
+void
+regex_memory_totals(size_t& regexes, size_t& bytes)
+{
+  regexes = live_regexes;
+  bytes   = live_bytes;
+}
+
+JanetTable*
+regex_info(const JanetRegex* regex)
+{
+  JanetTable* info = janet_table(8);
+  janet_table_put(info, janet_ckeywordv("engine"), janet_ckeywordv(regex->engine->name));
+  if (regex->pattern)
+    janet_table_put(info, janet_ckeywordv("pattern"), janet_cstringv(regex->pattern->c_str()));
+
+  JanetArray* flags = janet_array(0);
+  if (regex->flags)
+  {
+    for (auto&& flag : *regex->flags)
+      janet_array_push(flags, janet_ckeywordv(flag.c_str()));
+  }
+  janet_table_put(info, janet_ckeywordv("flags"), janet_wrap_array(flags));
+  janet_table_put(info, janet_ckeywordv("captures"), janet_wrap_integer(regex->engine->captures(regex)));
+  janet_table_put(info, janet_ckeywordv("memory"), janet_wrap_number((double)regex_memory(regex)));
+  if (regex->prefilter)
+    janet_table_put(info, janet_ckeywordv("prefilter"), janet_cstringv(regex->prefilter->literal.c_str()));
+  regex->engine->info(regex, info);
+  return info;
+}
+
+RegexMatcherPtr
+regex_matcher(const JanetRegex* regex, bool any)
+{
+  auto matcher = regex->engine->matcher(regex, any);
+  if (!regex->prefilter)
+    return matcher;
+  return RegexMatcherPtr(new PrefilterMatcher(std::move(matcher), *regex->prefilter));
+}
+
+bool
+regex_substitute(const JanetRegex* regex, const char* subject, size_t length, const char* subst, bool all,
+                 JanetBuffer* out, std::string& error)
+{
+  if (regex->prefilter && find_caseless(subject, length, 0, *regex->prefilter) == SIZE_MAX)
+  {
+    janet_buffer_push_bytes(out, (const uint8_t*)subject, (int32_t)length);
+    return true;
+  }
+  return regex->engine->substitute(regex, subject, length, subst, all, out, error);
+}
+
+bool
+regex_match(const JanetRegex* regex, const char* subject, size_t length, size_t start, bool firstOnly,
+            MatchResults& results, std::string& error)
+{
+  auto matcher = regex_matcher(regex, false);
+  matcher->reset(subject, length, start);
+  while (matcher->next())
+  {
+    push_match(regex, matcher->spans(), matcher->count(), results);
+    if (firstOnly)
+      break;
+  }
+  error = matcher->error();
+  return error.empty();
+}
+
+bool
+regex_contains(const JanetRegex* regex, const char* subject, size_t length, size_t start, std::string& error)
+{
+  auto matcher = regex_matcher(regex, true);
+  matcher->reset(subject, length, start);
+  if (matcher->next())
+    return true;
+  error = matcher->error();
+  return false;
+}
+
+bool
+regex_find(const JanetRegex* regex, const char* subject, size_t length, size_t start, bool firstOnly,
+           std::vector<size_t>& begins, std::string& error)
+{
+  auto matcher = regex_matcher(regex, false);
+  matcher->reset(subject, length, start);
+  while (matcher->next())
+  {
+    begins.push_back(matcher->spans()[0]);
+    if (firstOnly)
+      break;
+  }
+  error = matcher->error();
+  return error.empty();
+}
+
+bool
+regex_find_last(const JanetRegex* regex, const char* subject, size_t length, bool& found, size_t& begin,
+                std::string& error)
+{
+  found        = false;
+  auto   walk  = regex_matcher(regex, false);
+  auto   retry = regex_matcher(regex, false);
+  bool   utf   = utf_starts(regex);
+  size_t limit = length + 1; // no match starts at or after this
+  for (size_t window = last_window;; window *= 2)
+  {
+    // the last match of a walk from the window start ends before the next
+    // match starts, so the rightmost start lies within it
+    size_t from = limit > window ? limit - window : 0;
+    size_t end  = 0;
+    while (utf && from > 0 && from < length && ((uint8_t)subject[from] & 0xC0) == 0x80)
+      ++from;
+    walk->reset(subject, length, from);
+    while (walk->next() && walk->spans()[0] < limit)
+    {
+      found = true;
+      begin = walk->spans()[0];
+      end   = walk->spans()[1];
+    }
+    error = walk->error();
+    if (!error.empty())
+      return false;
+
+    // a later match may start inside it, where the walk did not look
+    while (found && begin + 1 < end)
+    {
+      size_t next = begin + 1;
+      while (utf && next < end && ((uint8_t)subject[next] & 0xC0) == 0x80)
+        ++next;
+      retry->reset(subject, length, next);
+      if (!retry->next())
+      {
+        error = retry->error();
+        if (!error.empty())
+          return false;
+        break;
+      }
+      if (retry->spans()[0] >= end)
+        break;
+      begin = retry->spans()[0];
+    }
+    if (found || from == 0)
+      return true;
+    limit = from;
+  }
+}
+
+int64_t
+regex_count(const JanetRegex* regex, const char* subject, size_t length, size_t start, std::string& error)
+{
+  int64_t count   = 0;
+  auto    matcher = regex_matcher(regex, false);
+  matcher->reset(subject, length, start);
+  while (matcher->next())
+    ++count;
+  error = matcher->error();
+  return error.empty() ? count : -1;
+}
+
+bool
+regex_match_named(const JanetRegex* regex, const char* subject, size_t length, size_t start, bool spans,
+                  Janet* result, std::string& error)
+{
+  if (!regex->engine->group_name)
+  {
+    error = std::string("named groups are not supported by the ") + regex->engine->name + " engine";
+    return false;
+  }
+
+  auto matcher = regex_matcher(regex, false);
+  matcher->reset(subject, length, start);
+  if (!matcher->next())
+  {
+    error   = matcher->error();
+    *result = janet_wrap_nil();
+    return error.empty();
+  }
+
+  const size_t*                   span = matcher->spans();
+  std::vector<const std::string*> names;
+  std::vector<int>                set;
+  for (int i = 1; i < matcher->count(); ++i)
+  {
+    const std::string* name = regex->engine->group_name(regex, i);
+    if (!name || span[2 * i] == SIZE_MAX)
+      continue;
+    bool duplicate = false;
+    for (auto* seen : names)
+      duplicate = duplicate || *seen == *name;
+    if (duplicate)
+      continue;
+    names.push_back(name);
+    set.push_back(i);
+  }
+
+  JanetKV* st = janet_struct_begin((int32_t)set.size());
+  for (size_t k = 0; k < set.size(); ++k)
+  {
+    size_t begin = span[2 * set[k]];
+    size_t end   = span[2 * set[k] + 1];
+    Janet  value;
+    if (spans)
+    {
+      Janet* pair = janet_tuple_begin(2);
+      pair[0]     = janet_wrap_integer((int32_t)begin);
+      pair[1]     = janet_wrap_integer((int32_t)end);
+      value       = janet_wrap_tuple(janet_tuple_end(pair));
+    }
+    else
+    {
+      value = janet_stringv((const uint8_t*)subject + begin, (int32_t)(end - begin));
+    }
+    janet_struct_put(st, janet_ckeywordv(names[k]->c_str()), value);
+  }
+  *result = janet_wrap_struct(janet_struct_end(st));
+  return true;
+}
+
+int
+regex_grep_lines(const JanetRegex* regex, const char* subject, size_t length, const GrepOptions& options,
+                 JanetArray* array, std::string& error)
+{
+  // one matcher for every line, only whether a line matches is needed
+  auto matcher = regex_matcher(regex, true);
+  return grep_lines(subject, length, options,
+                    [&](const char* line, size_t line_length) {
+                      matcher->reset(line, line_length, 0);
+                      if (matcher->next())
+                        return 1;
+                      error = matcher->error();
+                      return error.empty() ? 0 : -1;
+                    },
+                    array);
+}
+
+bool
+regex_extract_columns(const JanetRegex* regex, const std::vector<JanetByteView>& lines, bool intern,
+                      JanetArray* columns, std::string& error)
+{
+  // every column has a row per line, so rows are written in place rather
+  // than pushed, starting out nil
+  int32_t             rows   = (int32_t)lines.size();
+  int                 groups = regex->engine->captures(regex);
+  std::vector<Janet*> data;
+  for (int g = 0; g < groups; ++g)
+  {
+    JanetArray* column = janet_array(rows);
+    for (int32_t row = 0; row < rows; ++row)
+      column->data[row] = janet_wrap_nil();
+    column->count = rows;
+    janet_array_push(columns, janet_wrap_array(column));
+    data.push_back(column->data);
+  }
+
+  StringInterner strings(intern);
+  auto           matcher = regex_matcher(regex, false);
+  for (int32_t row = 0; row < rows; ++row)
+  {
+    const char* line = (const char*)lines[row].bytes;
+    matcher->reset(line, lines[row].len, 0);
+    if (!matcher->next())
+    {
+      error = matcher->error();
+      if (!error.empty())
+        return false;
+      continue;
+    }
+    const size_t* spans = matcher->spans();
+    int           count = std::min(matcher->count(), groups + 1);
+    for (int g = 1; g < count; ++g)
+    {
+      if (spans[2 * g] != SIZE_MAX)
+        data[g - 1][row] =
+            strings.string((const uint8_t*)line + spans[2 * g], (int32_t)(spans[2 * g + 1] - spans[2 * g]));
+    }
+  }
+  return true;
+}
+
+bool
+regex_replace_with(const JanetRegex* regex, const char* subject, size_t length, Replacer& replacer,
+                   JanetBuffer* out, Janet* error)
+{
+  auto matcher = regex_matcher(regex, false);
+  matcher->reset(subject, length, 0);
+
+  size_t             last   = 0;
+  size_t             groups = (size_t)regex->engine->captures(regex) + 1;
+  std::vector<Janet> captures;
+  while (matcher->next())
+  {
+    const size_t* spans = matcher->spans();
+    // \K can start a match before the end of the previous one
+    if (spans[0] > last)
+      janet_buffer_push_bytes(out, (const uint8_t*)subject + last, (int32_t)(spans[0] - last));
+
+    captures.clear();
+    for (int i = 0; i < matcher->count(); i++)
+    {
+      if (spans[2 * i] == SIZE_MAX)
+        captures.push_back(janet_wrap_nil());
+      else
+        captures.push_back(
+            janet_stringv((const uint8_t*)subject + spans[2 * i], (int32_t)(spans[2 * i + 1] - spans[2 * i])));
+    }
+    // PCRE2 leaves trailing unset groups out of its count, every group
+    // gets an argument so the arity does not change between matches
+    captures.resize(std::max(captures.size(), groups), janet_wrap_nil());
+    if (!replacer.append(out, captures.data(), (int32_t)captures.size()))
+    {
+      *error = replacer.error();
+      return false;
+    }
+    last = spans[1] > last ? spans[1] : last;
+  }
+
+  auto message = matcher->error();
+  if (!message.empty())
+  {
+    *error = janet_cstringv(message.c_str());
+    return false;
+  }
+
+  if (length > last)
+    janet_buffer_push_bytes(out, (const uint8_t*)subject + last, (int32_t)(length - last));
+  return true;
+}
+
+bool
+regex_template_groups(const JanetRegex* regex, const JanetTemplate* tmpl, std::vector<int>& named,
+                      std::string& error)
+{
+  int captures = regex->engine->captures(regex);
+  if (tmpl->maxGroup > captures)
+  {
+    std::ostringstream os;
+    os << "replacement template refers to group " << tmpl->maxGroup << " but pattern has " << captures;
+    error = os.str();
+    return false;
+  }
+
+  for (auto&& segment : *tmpl->segments)
+  {
+    if (segment.kind != TemplateSegmentKind::Named)
+      continue;
+    if (!regex->engine->group_name)
+    {
+      error = std::string("named groups in replacement templates are not supported by the ") + regex->engine->name +
+              " engine";
+      return false;
+    }
+    int number = group_number(regex, segment.name);
+    if (number < 0)
+    {
+      error = "unknown or duplicate group name '" + segment.name + "' in replacement template";
+      return false;
+    }
+    named.push_back(number);
+  }
+  return true;
+}
+
+bool
+regex_replace_template(const JanetRegex* regex, const char* subject, size_t length, const JanetTemplate* tmpl,
+                       bool all, JanetBuffer* out, std::string& error)
+{
+  std::vector<int> named;
+  if (!regex_template_groups(regex, tmpl, named, error))
+    return false;
+
+  auto matcher = regex_matcher(regex, false);
+  matcher->reset(subject, length, 0);
+
+  size_t last = 0;
+  while (matcher->next())
+  {
+    const size_t* spans = matcher->spans();
+    if (spans[0] > last)
+      janet_buffer_push_bytes(out, (const uint8_t*)subject + last, (int32_t)(spans[0] - last));
+    TemplateAppend(tmpl, named, subject, length, spans, matcher->count(), out);
+    last = spans[1] > last ? spans[1] : last;
+    if (!all)
+      break;
+  }
+
+  error = matcher->error();
+  if (!error.empty())
+    return false;
+
+  if (length > last)
+    janet_buffer_push_bytes(out, (const uint8_t*)subject + last, (int32_t)(length - last));
+  return true;
+}
+
+bool
+regex_replace_in_place(const JanetRegex* regex, JanetBuffer* buffer, const JanetTemplate* tmpl, std::string& error)
+{
+  std::vector<int> named;
+  if (!regex_template_groups(regex, tmpl, named, error))
+    return false;
+
+  // Expand every replacement before touching the buffer, so groups, $` and
+  // $' all read the original text. Only the replacements are copied.
+  struct Edit
+  {
+    size_t begin, end;         // replaced bytes of the buffer
+    size_t expansion, expands; // offset and length in expanded
+  };
+  std::vector<Edit> edits;
+  JanetBuffer       expanded;
+  janet_buffer_init(&expanded, 0);
+  {
+    const char* subject = (const char*)buffer->data;
+    size_t      length  = (size_t)buffer->count;
+    auto        matcher = regex_matcher(regex, false);
+    matcher->reset(subject, length, 0);
+
+    size_t last = 0;
+    while (matcher->next())
+    {
+      const size_t* spans = matcher->spans();
+      size_t        at    = (size_t)expanded.count;
+      TemplateAppend(tmpl, named, subject, length, spans, matcher->count(), &expanded);
+      // \K can start a match before the end of the previous one
+      size_t begin = spans[0] > last ? spans[0] : last;
+      last         = spans[1] > last ? spans[1] : last;
+      edits.push_back({ begin, last, at, (size_t)expanded.count - at });
+    }
+    error = matcher->error();
+  }
+  if (!error.empty())
+  {
+    janet_buffer_deinit(&expanded);
+    return false;
+  }
+
+  // Text can be moved within the buffer in one direction only if every run
+  // of edits from the start moves it that way: forward when the result so
+  // far is never longer, from the back when it is never shorter.
+  size_t    length  = (size_t)buffer->count;
+  size_t    result  = length;
+  long long shift   = 0;
+  bool      shrinks = true;
+  bool      grows   = true;
+  for (auto&& edit : edits)
+  {
+    result = result - (edit.end - edit.begin) + edit.expands;
+    shift += (long long)edit.expands - (long long)(edit.end - edit.begin);
+    shrinks = shrinks && shift <= 0;
+    grows   = grows && shift >= 0;
+  }
+  if (result > INT32_MAX)
+  {
+    janet_buffer_deinit(&expanded);
+    error = "result of replace-all! is too large for a buffer";
+    return false;
+  }
+
+  if (shrinks)
+  {
+    // never longer, so writes stay behind the text still to be moved
+    uint8_t* data  = buffer->data;
+    size_t   write = edits.empty() ? length : edits[0].begin;
+    for (size_t i = 0; i < edits.size(); ++i)
+    {
+      memcpy(data + write, expanded.data + edits[i].expansion, edits[i].expands);
+      write += edits[i].expands;
+      size_t next = i + 1 < edits.size() ? edits[i + 1].begin : length;
+      memmove(data + write, data + edits[i].end, next - edits[i].end);
+      write += next - edits[i].end;
+    }
+  }
+  else if (grows)
+  {
+    // grow once, then fill from the back so moved text is never overwritten
+    janet_buffer_ensure(buffer, (int32_t)result, 1);
+    uint8_t* data  = buffer->data;
+    size_t   write = result;
+    for (size_t i = edits.size(); i-- > 0;)
+    {
+      size_t next = i + 1 < edits.size() ? edits[i + 1].begin : length;
+      write -= next - edits[i].end;
+      memmove(data + write, data + edits[i].end, next - edits[i].end);
+      write -= edits[i].expands;
+      memcpy(data + write, expanded.data + edits[i].expansion, edits[i].expands);
+    }
+  }
+  else
+  {
+    // edits both ways would overwrite text in either order, so put the
+    // result together after the expansions and copy it back once
+    size_t   start = (size_t)expanded.count;
+    uint8_t* data  = buffer->data;
+    size_t   read  = 0;
+    janet_buffer_ensure(&expanded, (int32_t)(start + result), 1);
+    for (auto&& edit : edits)
+    {
+      janet_buffer_push_bytes(&expanded, data + read, (int32_t)(edit.begin - read));
+      janet_buffer_push_bytes(&expanded, expanded.data + edit.expansion, (int32_t)edit.expands);
+      read = edit.end;
+    }
+    janet_buffer_push_bytes(&expanded, data + read, (int32_t)(length - read));
+    janet_buffer_ensure(buffer, (int32_t)result, 1);
+    memcpy(buffer->data, expanded.data + start, result);
+  }
+  buffer->count = (int32_t)result;
+  janet_buffer_deinit(&expanded);
+  return true;
+}
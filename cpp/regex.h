@@ -0,0 +1,214 @@
+#pragma once
+
+#include <janet.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "grep.h"
+#include "prefilter.h"
+#include "results.h"
+#include "template.h"
+
+struct RegexEngine;
+
+// Header shared by the compiled regexes of every engine. They are all
+// `regex_type` abstracts, so a native checks the type once and then
+// dispatches through `engine`; the engine structs extend this one.
+struct JanetRegex
+{
+  const RegexEngine*        engine    = nullptr;
+  std::string*              pattern   = nullptr; // the error message if compilation failed
+  std::vector<std::string>* flags     = nullptr;
+  CaselessPrefilter*        prefilter = nullptr; // text every :ignorecase match contains
+  size_t                    memory    = 0;       // native bytes counted in the totals, 0 if not counted
+};
+
+extern JanetAbstractType regex_type;
+
+void initialize_regex_type();
+
+// Frees the engine state, pattern and flags. Also called directly to release
+// a regex compiled for a single call, the gc hook then finds nothing to free.
+int  regex_gc(void* data, size_t len);
+void regex_tostring(void* data, JanetBuffer* buffer);
+
+// Compiled regexes marshal as engine, pattern and flags, plus the engine's
+// serialized code if it has one, so regexes in an image are not compiled
+// again when it loads. The code is trusted, like the rest of the image.
+void  regex_marshal(void* data, JanetMarshalContext* ctx);
+void* regex_unmarshal(JanetMarshalContext* ctx);
+
+// Result of an engine's compile: regex if ok, otherwise null with the error
+// message from `pattern`, and the regex is released straight away. A
+// compiled regex is counted by regex_account.
+JanetRegex* regex_compiled(JanetRegex* regex, bool ok, std::string& error);
+
+// Native memory of a regex: the engine's state, pattern, flags and prefilter.
+size_t regex_memory(const JanetRegex* regex);
+
+// Count a compiled regex and its native memory, as measured now, in the
+// totals until it is freed. The GC is not told, since most regexes
+// compiled for one call are freed before it returns; callers that keep
+// the regex report regex->memory with janet_gcpressure.
+void regex_account(JanetRegex* regex);
+
+// Regexes counted by regex_account and not yet freed, and their bytes.
+void regex_memory_totals(size_t& regexes, size_t& bytes);
+
+// Walks successive non-overlapping matches of one subject. reset() starts a
+// new walk and keeps any buffers, so one matcher can serve many subjects.
+// A start past the end of the subject finds nothing.
+class RegexMatcher
+{
+public:
+  virtual ~RegexMatcher() = default;
+
+  virtual void reset(const char* subject, size_t length, size_t start) = 0;
+
+  // Advance to the next match. False at the end of the subject or on error.
+  virtual bool next() = 0;
+
+  // begin/end pairs for the match and its groups, SIZE_MAX when unset.
+  virtual const size_t* spans() const = 0;
+  virtual int           count() const = 0;
+
+  // Why the walk stopped early, empty if it reached the end of the subject.
+  virtual std::string error() const = 0;
+};
+
+using RegexMatcherPtr = std::unique_ptr<RegexMatcher>;
+
+// What an engine provides. Everything else (results, counting, grep,
+// replacement with functions and templates) is built on the matcher.
+struct RegexEngine
+{
+  const char* name; // as reported in jre/info
+
+  // Compile pattern with the flags in argv[flag_start, argc). On failure
+  // returns null with the message in error.
+  JanetRegex* (*compile)(const char* pattern, const Janet* argv, int32_t flag_start, int32_t argc,
+                         std::string& error);
+
+  // Free the engine's own state, pattern and flags are freed by regex_gc.
+  void (*release)(JanetRegex* regex);
+
+  int (*captures)(const JanetRegex* regex);
+
+  // Add engine specific entries to the jre/info table.
+  void (*info)(const JanetRegex* regex, JanetTable* info);
+
+  // With `any` the caller only asks whether there is a match, so the engine
+  // may report a different one than the leftmost.
+  RegexMatcherPtr (*matcher)(const JanetRegex* regex, bool any);
+
+  // Replace the first or every match with subst, in the engine's own
+  // replacement syntax, appending the result to out.
+  bool (*substitute)(const JanetRegex* regex, const char* subject, size_t length, const char* subst, bool all,
+                     JanetBuffer* out, std::string& error);
+
+  // Name of a capture group, null if it has none. Null for engines
+  // without named groups.
+  const std::string* (*group_name)(const JanetRegex* regex, int group);
+
+  // Size of the engine's regex struct.
+  size_t size;
+
+  // Set up an unmarshalled regex, zeroed memory of `size` bytes, from its
+  // pattern and flags. `serialized` is what `serialize` gave, and is used
+  // in place of compiling when the engine can. False if it does not
+  // compile, with the message in `pattern`.
+  bool (*restore)(JanetRegex* regex, const char* pattern, const Janet* argv, int32_t argc,
+                  const std::string& serialized);
+
+  // The compiled form to marshal with the pattern. Null for engines that
+  // compile the pattern again.
+  std::string (*serialize)(const JanetRegex* regex);
+  // How many bytes before where a search starts the engine may read, for
+  // lookbehind and assertions such as \b; SIZE_MAX when unbounded.
+  size_t (*lookbehind)(const JanetRegex* regex);
+
+  // Bytes of native memory the engine's state holds, outside the Janet
+  // heap, or an estimate when the engine does not say.
+  size_t (*memory)(const JanetRegex* regex);
+};
+
+// The engine called name, a keyword, or null.
+const RegexEngine* get_regex_engine(Janet name);
+
+// Table with the engine, pattern, flags and capture count, plus whatever
+// the engine adds.
+JanetTable* regex_info(const JanetRegex* regex);
+
+// The engine's matcher, behind the prefilter when the regex has one, so a
+// walk skips ahead to where the required text occurs and ends once the
+// rest of the subject lacks it.
+RegexMatcherPtr regex_matcher(const JanetRegex* regex, bool any);
+
+// Run the engine's own substitute, or copy subject when the prefilter rules
+// out every match.
+bool regex_substitute(const JanetRegex* regex, const char* subject, size_t length, const char* subst, bool all,
+                      JanetBuffer* out, std::string& error);
+
+// The functions below return false, or a negative count, with a message in
+// error when the engine gives up part way through.
+
+// Append the first or every match to results.
+bool regex_match(const JanetRegex* regex, const char* subject, size_t length, size_t start, bool firstOnly,
+                 MatchResults& results, std::string& error);
+
+bool regex_contains(const JanetRegex* regex, const char* subject, size_t length, size_t start, std::string& error);
+
+// Begin offsets of the first or every match.
+bool regex_find(const JanetRegex* regex, const char* subject, size_t length, size_t start, bool firstOnly,
+                std::vector<size_t>& begins, std::string& error);
+
+// Begin offset of the rightmost match, searching windows that double in
+// size back from the end of the subject. Where matches can overlap this may
+// lie inside the last one regex_find reports. found is false when there is
+// no match.
+bool regex_find_last(const JanetRegex* regex, const char* subject, size_t length, bool& found, size_t& begin,
+                     std::string& error);
+
+int64_t regex_count(const JanetRegex* regex, const char* subject, size_t length, size_t start, std::string& error);
+
+// Struct of the named groups set in the first match at start, keyed by
+// name; duplicate names take the first set group. Values are the captured
+// strings, or [begin end] tuples when spans is true. Nil when there is no match.
+bool regex_match_named(const JanetRegex* regex, const char* subject, size_t length, size_t start, bool spans,
+                       Janet* result, std::string& error);
+
+// Select the lines of subject that match, matching each line on its own so
+// ^, $ and lookarounds see line boundaries.
+int regex_grep_lines(const JanetRegex* regex, const char* subject, size_t length, const GrepOptions& options,
+                     JanetArray* array, std::string& error);
+
+// Columns of the capture groups of the first match in each line: one array
+// per group, with a row for every line holding the group's text, or nil
+// when the line does not match or the group is unset. Lines are matched on
+// their own, like regex_grep_lines. With intern set, equal values share
+// one string.
+bool regex_extract_columns(const JanetRegex* regex, const std::vector<JanetByteView>& lines, bool intern,
+                           JanetArray* columns, std::string& error);
+
+// Replace every match with the result of replacer, appending to out. The
+// matcher is not shared, so the callback may use the same regex. On failure
+// the callback or engine error is in *error.
+bool regex_replace_with(const JanetRegex* regex, const char* subject, size_t length, Replacer& replacer,
+                        JanetBuffer* out, Janet* error);
+
+// Check that the groups tmpl refers to exist in regex, resolving its names
+// to group numbers in named, once per call rather than per match.
+bool regex_template_groups(const JanetRegex* regex, const JanetTemplate* tmpl, std::vector<int>& named,
+                           std::string& error);
+
+// Replace the first (or every) match with the expansion of tmpl, appending to out.
+bool regex_replace_template(const JanetRegex* regex, const char* subject, size_t length, const JanetTemplate* tmpl,
+                            bool all, JanetBuffer* out, std::string& error);
+
+// Replace every match in buffer with the expansion of tmpl, rewriting the
+// buffer's own storage. Shorter or equal results are compacted in place,
+// longer ones grow the buffer once. The buffer is unchanged on error.
+bool regex_replace_in_place(const JanetRegex* regex, JanetBuffer* buffer, const JanetTemplate* tmpl,
+                            std::string& error);
@@ -0,0 +1,193 @@
+#include "replace_file.h"
+
+#include "mapped_file.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+// pages this far behind the scan are dropped, every time it moves this far
+const size_t release_step = 16 << 20;
+
+// Writes through a buffer of about size bytes, and longer runs straight
+// from the caller's memory.
+class FileWriter
+{
+public:
+  FileWriter(FILE* file, size_t size) : m_file(file), m_size(size) { m_buffer.reserve(size); }
+
+  ~FileWriter()
+  {
+    if (m_file)
+      fclose(m_file);
+  }
+
+  FileWriter(const FileWriter&)            = delete;
+  FileWriter& operator=(const FileWriter&) = delete;
+
+  bool ok() const { return m_error.empty(); }
+
+  const std::string& error() const { return m_error; }
+
+  void write(const char* data, size_t length)
+  {
+    if (length < m_size)
+    {
+      m_buffer.insert(m_buffer.end(), data, data + length);
+      if (m_buffer.size() >= m_size)
+        flush();
+      return;
+    }
+    flush();
+    put(data, length);
+  }
+
+  // Write what is buffered and close the file.
+  bool close()
+  {
+    flush();
+    if (m_file && fclose(m_file) != 0 && ok())
+      m_error = strerror(errno);
+    m_file = nullptr;
+    return ok();
+  }
+
+private:
+  void flush()
+  {
+    put(m_buffer.data(), m_buffer.size());
+    m_buffer.clear();
+  }
+
+  void put(const char* data, size_t length)
+  {
+    if (ok() && length > 0 && fwrite(data, 1, length, m_file) != length)
+      m_error = strerror(errno);
+  }
+
+  FILE*             m_file;
+  std::vector<char> m_buffer;
+  size_t            m_size;
+  std::string       m_error;
+};
+
+// Create a file of a new name beside destination and open it for writing,
+// setting path. It takes the mode of destination, or of source when there
+// is no destination yet. Null with errno set on failure.
+FILE*
+open_temporary(const std::string& source, const std::string& destination, std::string& path)
+{
+#ifdef _WIN32
+  size_t      slash = destination.find_last_of("/\\");
+  std::string dir   = slash == std::string::npos ? "." : destination.substr(0, slash + 1);
+  char        name[MAX_PATH];
+  if (GetTempFileNameA(dir.c_str(), "jre", 0, name) == 0)
+  {
+    errno = EACCES;
+    return nullptr;
+  }
+  path = name;
+  return fopen(name, "wb");
+#else
+  std::vector<char> name(destination.begin(), destination.end());
+  const char        suffix[] = ".jre-XXXXXX";
+  name.insert(name.end(), suffix, suffix + sizeof(suffix));
+  int fd = mkstemp(name.data());
+  if (fd < 0)
+    return nullptr;
+  path = name.data();
+  struct stat st;
+  if (stat(destination.c_str(), &st) == 0 || stat(source.c_str(), &st) == 0)
+    fchmod(fd, st.st_mode & 07777);
+  FILE* file = fdopen(fd, "wb");
+  if (!file)
+    close(fd);
+  return file;
+#endif
+}
+
+bool
+rename_over(const std::string& from, const std::string& to)
+{
+#ifdef _WIN32
+  return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+}
+
+bool
+replace_file(const JanetRegex* regex, const std::string& source, const std::string& destination,
+             const JanetTemplate* tmpl, size_t buffer_size, size_t& count, std::string& error)
+{
+  std::vector<int> named;
+  if (!regex_template_groups(regex, tmpl, named, error))
+    return false;
+
+  std::string temporary;
+  count = 0;
+  {
+    // closed before the rename, which a mapping would block on Windows
+    MappedFile file(source);
+    if (!file.ok())
+    {
+      error = "cannot read " + source;
+      return false;
+    }
+    FILE* out = open_temporary(source, destination, temporary);
+    if (!out)
+    {
+      error = "cannot write beside " + destination + ": " + strerror(errno);
+      if (!temporary.empty())
+        std::remove(temporary.c_str());
+      return false;
+    }
+    FileWriter writer(out, buffer_size);
+    auto       write = [&writer](const char* data, size_t length) { writer.write(data, length); };
+
+    const char* subject  = file.data();
+    size_t      length   = file.length();
+    auto        matcher  = regex_matcher(regex, false);
+    size_t      last     = 0;
+    size_t      released = 0;
+    matcher->reset(subject, length, 0);
+    while (matcher->next() && writer.ok())
+    {
+      const size_t* spans = matcher->spans();
+      if (spans[0] > last)
+        writer.write(subject + last, spans[0] - last);
+      TemplateExpand(tmpl, named, subject, length, spans, matcher->count(), write);
+      last = spans[1] > last ? spans[1] : last;
+      ++count;
+      if (last >= released + 2 * release_step)
+      {
+        released = last - release_step;
+        file.release(released);
+      }
+    }
+    error = matcher->error();
+    if (error.empty() && length > last)
+      writer.write(subject + last, length - last);
+    if (error.empty() && !writer.close())
+      error = "cannot write " + temporary + ": " + writer.error();
+  }
+
+  if (error.empty() && !rename_over(temporary, destination))
+    error = "cannot replace " + destination + ": " + strerror(errno);
+  if (!error.empty())
+  {
+    std::remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
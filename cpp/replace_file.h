@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "regex.h"
+#include "template.h"
+
+// Rewriting files too large to hold in memory, for jre/replace-file. The
+// source is mapped rather than read in chunks, so a match may span any
+// amount of it and every engine works unchanged, and the pages the scan
+// has passed are dropped as it moves on. Output goes through one buffer of
+// a fixed size, with the text between matches written straight from the
+// mapping, so the memory used does not grow with the file. Template
+// expansions go the same way: only their literal text is copied, groups,
+// $` and $' are written from the mapping, so no match is too long.
+//
+// The result is written to a newly named temporary file beside destination
+// and renamed over it at the end, so destination may be the source itself,
+// and is left as it was if anything fails.
+
+// Replace every match of regex in the file at source with the expansion of
+// tmpl, writing the result to destination and the number of matches to
+// count. Returns false with a message in error when a file cannot be read
+// or written or the engine fails.
+bool replace_file(const JanetRegex* regex, const std::string& source, const std::string& destination,
+                  const JanetTemplate* tmpl, size_t buffer_size, size_t& count, std::string& error);
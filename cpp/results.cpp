@@ -1,32 +1,75 @@
 #include "results.h"
 
+#include <cstring>
 #include <iostream>
 
+MatchResults&
+match_arena()
+{
+  static thread_local MatchResults results;
+  results.clear();
+  return results;
+}
+
 Janet
-MatchResultsToArray(const std::vector<ReMatch>& matches)
+StringInterner::string(const uint8_t* bytes, int32_t length)
 {
-  JanetArray* array = janet_array(matches.size());
+  if (!m_enabled || length > max_length)
+    return janet_stringv(bytes, length);
+
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (int32_t i = 0; i < length; ++i)
+    hash = (hash ^ bytes[i]) * 16777619u;
+
+  if (m_slots.empty())
+    m_slots.assign(slots, janet_wrap_nil());
+  Janet& slot = m_slots[hash % slots];
+  if (janet_checktype(slot, JANET_STRING))
+  {
+    const uint8_t* cached = janet_unwrap_string(slot);
+    if (janet_string_length(cached) == length && memcmp(cached, bytes, length) == 0)
+      return slot;
+  }
+  slot = janet_stringv(bytes, length);
+  return slot;
+}
 
-  for (auto&& m : matches)
+namespace
+{
+JanetTable*
+span_table(const MatchSpan& span, const char* subject, bool group, StringInterner& strings)
+{
+  JanetTable* table = janet_table(group ? 5 : 4);
+  if (group)
   {
-    JanetTable* match = janet_table(0);
-    janet_table_put(match, janet_ckeywordv("begin"), janet_wrap_integer((int32_t)m.begin));
-    janet_table_put(match, janet_ckeywordv("end"), janet_wrap_integer((int32_t)m.end));
-    janet_table_put(match, janet_ckeywordv("val"),
-                    janet_wrap_string(janet_string((uint8_t*)m.val.data(), m.val.size())));
-    if (!m.groups.empty())
+    janet_table_put(table, janet_ckeywordv("group-index"), janet_wrap_integer(span.index));
+    if (span.name)
+      janet_table_put(table, janet_ckeywordv("name"), janet_ckeywordv(span.name->c_str()));
+  }
+  janet_table_put(table, janet_ckeywordv("begin"), janet_wrap_integer((int32_t)span.begin));
+  janet_table_put(table, janet_ckeywordv("end"), janet_wrap_integer((int32_t)span.end));
+  janet_table_put(table, janet_ckeywordv("val"),
+                  strings.string((const uint8_t*)subject + span.begin, (int32_t)(span.end - span.begin)));
+  return table;
+}
+}
+
+Janet
+MatchResultsToArray(const MatchResults& results, const char* subject, bool intern)
+{
+  StringInterner strings(intern);
+  JanetArray*    array = janet_array((int32_t)results.size());
+  for (size_t m = 0; m < results.size(); ++m)
+  {
+    size_t      first = results.starts[m];
+    size_t      last  = m + 1 < results.size() ? results.starts[m + 1] : results.spans.size();
+    JanetTable* match = span_table(results.spans[first], subject, false, strings);
+    if (last > first + 1)
     {
-      JanetArray* groups = janet_array(m.groups.size());
-      for (auto&& g : m.groups)
-      {
-        JanetTable* group = janet_table(0);
-        janet_table_put(group, janet_ckeywordv("group-index"), janet_wrap_integer((int32_t)g.index));
-        janet_table_put(group, janet_ckeywordv("begin"), janet_wrap_integer((int32_t)g.begin));
-        janet_table_put(group, janet_ckeywordv("end"), janet_wrap_integer((int32_t)g.end));
-        janet_table_put(group, janet_ckeywordv("val"),
-                        janet_wrap_string(janet_string((uint8_t*)g.val.data(), g.val.size())));
-        janet_array_push(groups, janet_wrap_table(group));
-      }
+      JanetArray* groups = janet_array((int32_t)(last - first - 1));
+      for (size_t g = first + 1; g < last; ++g)
+        janet_array_push(groups, janet_wrap_table(span_table(results.spans[g], subject, true, strings)));
       janet_table_put(match, janet_ckeywordv("groups"), janet_wrap_array(groups));
     }
     janet_array_push(array, janet_wrap_table(match));
@@ -34,3 +77,58 @@ MatchResultsToArray(const std::vector<ReMatch>& matches)
 
   return janet_wrap_array(array);
 }
+
+namespace
+{
+void
+buffer_push_value(JanetBuffer* out, Janet value)
+{
+  const uint8_t* bytes;
+  int32_t        len;
+  if (janet_bytes_view(value, &bytes, &len))
+    janet_buffer_push_bytes(out, bytes, len);
+  else
+    janet_buffer_push_string(out, janet_to_string(value));
+}
+}
+
+Replacer::~Replacer()
+{
+  if (m_rooted)
+    janet_gcunroot(janet_wrap_fiber(m_rooted));
+}
+
+bool
+Replacer::append(JanetBuffer* out, const Janet* captures, int32_t count)
+{
+  Janet value = janet_wrap_nil();
+  if (janet_checktype(m_replacement, JANET_FUNCTION))
+  {
+    // janet_pcall clears the fiber it is given on some failures, such as an
+    // arity mismatch, so the one rooted is kept apart
+    JanetFiber* fiber  = m_fiber;
+    auto        signal = janet_pcall(janet_unwrap_function(m_replacement), count, captures, &value, &fiber);
+    if (fiber && fiber != m_rooted)
+    {
+      if (m_rooted)
+        janet_gcunroot(janet_wrap_fiber(m_rooted));
+      janet_gcroot(janet_wrap_fiber(fiber));
+      m_rooted = fiber;
+    }
+    m_fiber = fiber;
+    if (signal != JANET_SIGNAL_OK)
+    {
+      m_error = value;
+      return false;
+    }
+  }
+  else
+  {
+    value = janet_get(m_replacement, captures[0]);
+  }
+
+  if (janet_checktype(value, JANET_NIL))
+    value = captures[0];
+  buffer_push_value(out, value);
+  return true;
+}
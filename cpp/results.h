@@ -4,13 +4,88 @@
 #include <string>
 #include <vector>
 
-struct ReMatch
+// A match or one of its capture groups, as offsets into the subject.
+struct MatchSpan
 {
-  int64_t              index  = 0;
-  int64_t              begin  = -1;
-  int64_t              end    = -1;
-  std::string          val    = "";
-  std::vector<ReMatch> groups = {};
+  size_t             begin = 0;
+  size_t             end   = 0;
+  int                index = 0;       // group number, 0 for the whole match
+  const std::string* name  = nullptr; // owned by the regex, set for named groups
 };
 
-Janet MatchResultsToArray(const std::vector<ReMatch>& matches);
+// The matches of one call stored flat, each whole match followed by the
+// groups that took part in it. No strings are copied out of the subject
+// until the results are converted to Janet, and since match_arena() hands
+// out the same instance every call, collecting matches stops allocating
+// once the vectors have grown to fit.
+struct MatchResults
+{
+  std::vector<MatchSpan> spans;
+  std::vector<size_t>    starts; // index into spans of each whole match
+
+  size_t size() const { return starts.size(); }
+  void   clear()
+  {
+    spans.clear();
+    starts.clear();
+  }
+};
+
+// Cleared results reused across calls, one per thread. Only valid until
+// the next call, so convert them before running any Janet code.
+MatchResults& match_arena();
+
+// Makes the strings for captured values, optionally handing back the same
+// string for bytes it has made before. Log fields such as methods, status
+// codes and hostnames repeat on most lines, and sharing them saves an
+// allocation and the garbage it leaves behind.
+//
+// The cache is direct mapped, so a slot holds the last short value that
+// hashed to it and a collision only costs a fresh string. It lives for one
+// call: its strings are unrooted, which is safe only while no Janet code
+// runs, and reached from the results once it returns.
+class StringInterner
+{
+public:
+  explicit StringInterner(bool enabled) : m_enabled(enabled) {}
+
+  Janet string(const uint8_t* bytes, int32_t length);
+
+private:
+  static constexpr int32_t max_length = 32;
+  static constexpr size_t  slots      = 512;
+
+  bool               m_enabled;
+  std::vector<Janet> m_slots; // allocated on first use, nil when empty
+};
+
+// With intern set, equal captured values share one string.
+Janet MatchResultsToArray(const MatchResults& results, const char* subject, bool intern = false);
+
+// Produces the replacement for each match in replace-with. `replacement`
+// is either a function, called with the match followed by its capture
+// groups, or a table/struct keyed by the matched text. A nil result or a
+// missing key keeps the matched text.
+//
+// Function calls run on one fiber reused for every match, rooted for the
+// lifetime of the Replacer.
+class Replacer
+{
+public:
+  explicit Replacer(Janet replacement) : m_replacement(replacement) {}
+  ~Replacer();
+
+  Replacer(const Replacer&)            = delete;
+  Replacer& operator=(const Replacer&) = delete;
+
+  // `captures[0]` is the whole match. Returns false if the function raised
+  // an error, which is then available from error().
+  bool  append(JanetBuffer* out, const Janet* captures, int32_t count);
+  Janet error() const { return m_error; }
+
+private:
+  Janet       m_replacement;
+  Janet       m_error = janet_wrap_nil();
+  JanetFiber* m_fiber  = nullptr; // reused for each call
+  JanetFiber* m_rooted = nullptr; // the fiber rooted, unrooted on destruction
+};
@@ -0,0 +1,291 @@
+#include "rewriter.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+namespace
+{
+std::string
+combine_rules(const std::vector<std::string>& patterns)
+{
+  // rules may reuse group names, each resolves its own
+  std::ostringstream os;
+  os << "(?J)";
+  for (size_t i = 0; i < patterns.size(); ++i)
+  {
+    if (i > 0)
+      os << "|";
+    os << "(*MARK:" << i << ")(?:" << patterns[i] << ")";
+  }
+  return os.str();
+}
+
+// Whether pattern has a numbered back reference, subroutine call or
+// condition, such as \1, \g{2}, (?1) or (?(1)...), which in the combined
+// pattern would name an earlier rule's group. With whole_only, only
+// recursion into the whole pattern, (?R) or (?0), which would run every
+// rule. Relative and named references stay within their rule.
+bool
+numbered_reference(const char* pattern, bool whole_only)
+{
+  auto digit = [](char c) { return c >= '0' && c <= '9'; };
+  for (const char* p = pattern; *p; ++p)
+  {
+    if (*p == '\\')
+    {
+      if (p[1] == 'Q')
+      {
+        const char* end = strstr(p + 2, "\\E");
+        if (!end)
+          return false;
+        p = end + 1;
+        continue;
+      }
+      if (!whole_only && p[1] >= '1' && p[1] <= '9')
+        return true;
+      if (p[1] == 'g')
+      {
+        const char* q = p + 2;
+        if (*q == '{' || *q == '<' || *q == '\'')
+          ++q;
+        if (digit(*q) && (!whole_only || (*q == '0' && !digit(q[1]))))
+          return true;
+      }
+      if (p[1])
+        ++p;
+    }
+    else if (*p == '[')
+    {
+      // a class: \1 in one is an octal escape
+      const char* q = p + 1;
+      if (*q == '^')
+        ++q;
+      if (*q == ']')
+        ++q;
+      while (*q && *q != ']')
+      {
+        if (*q == '\\' && q[1])
+          q += 2;
+        else if (*q == '[' && q[1] == ':' && strstr(q + 2, ":]"))
+          q = strstr(q + 2, ":]") + 2;
+        else
+          ++q;
+      }
+      if (!*q)
+        return false;
+      p = q;
+    }
+    else if (*p == '(' && p[1] == '?')
+    {
+      bool whole = p[2] == 'R' || (p[2] == '0' && p[3] == ')');
+      if (whole || (!whole_only && (digit(p[2]) || (p[2] == '(' && digit(p[3])))))
+        return true;
+    }
+  }
+  return false;
+}
+
+// Compile each rule alone, so errors name the rule and an unbalanced rule
+// cannot pair up with its neighbours, and find where its groups will be.
+bool
+check_rules(const std::vector<std::string>& patterns, JanetTuple templates, const std::vector<Janet>& flags,
+            std::vector<RewriteRule>& rules, std::string& error)
+{
+  std::vector<Janet> check_flags = flags;
+  check_flags.push_back(janet_ckeywordv("jit"));
+  check_flags.push_back(janet_ckeywordv("off"));
+  int offset = 0;
+  for (size_t i = 0; i < patterns.size(); ++i)
+  {
+    JanetPCRE2Regex* regex = new_abstract_pcre2_regex(patterns[i].c_str(), check_flags.data(), 0,
+                                                      (int32_t)check_flags.size());
+    RewriteRule rule;
+    rule.tmpl     = (const JanetTemplate*)janet_unwrap_abstract(templates[i]);
+    rule.offset   = offset;
+    std::string message;
+    bool        ok = regex->re != nullptr;
+    if (!ok)
+      message = *regex->pattern;
+    else
+    {
+      rule.captures = pcre2_engine.captures(regex);
+      ok            = regex_template_groups(regex, rule.tmpl, rule.named, message);
+    }
+    // the first rule's groups keep their numbers
+    if (ok && numbered_reference(patterns[i].c_str(), i == 0))
+    {
+      ok      = false;
+      message = "numbered references and (?R) would reach other rules, use names or relative numbers";
+    }
+    regex_gc(regex, 0);
+    if (!ok)
+    {
+      std::ostringstream os;
+      os << "rewriter rule " << i << " (" << patterns[i] << "): " << message;
+      error = os.str();
+      return false;
+    }
+    offset += rule.captures;
+    rules.push_back(std::move(rule));
+  }
+  return true;
+}
+}
+
+int
+rewriter_gc(void* data, size_t len)
+{
+  (void)len;
+  if (data)
+  {
+    JanetRewriter* rewriter = (JanetRewriter*)data;
+    if (rewriter->rules)
+    {
+      delete (rewriter->rules);
+      rewriter->rules = nullptr;
+    }
+    if (rewriter->error)
+    {
+      delete (rewriter->error);
+      rewriter->error = nullptr;
+    }
+  }
+  return 0;
+}
+
+int
+rewriter_gcmark(void* data, size_t len)
+{
+  (void)len;
+  JanetRewriter* rewriter = (JanetRewriter*)data;
+  if (rewriter->regex)
+    janet_mark(janet_wrap_abstract(rewriter->regex));
+  if (rewriter->templates)
+    janet_mark(janet_wrap_tuple(rewriter->templates));
+  return 0;
+}
+
+void
+rewriter_tostring(void* data, JanetBuffer* buffer)
+{
+  if (data)
+  {
+    JanetRewriter* rewriter = (JanetRewriter*)data;
+    if (!rewriter->rules)
+    {
+      janet_buffer_push_cstring(buffer, "no rules");
+      return;
+    }
+    janet_buffer_push_cstring(buffer, std::to_string(rewriter->rules->size()).c_str());
+    janet_buffer_push_cstring(buffer, " rules");
+  }
+}
+
+JanetAbstractType rewriter_type = {};
+
+void
+initialize_rewriter_type()
+{
+  if (!rewriter_type.name)
+  {
+    rewriter_type.name     = "jre-rewriter";
+    rewriter_type.gc       = rewriter_gc;
+    rewriter_type.gcmark   = rewriter_gcmark;
+    rewriter_type.tostring = rewriter_tostring;
+  }
+}
+
+JanetRewriter*
+new_abstract_rewriter(const std::vector<std::string>& patterns, JanetTuple templates, const Janet* flags,
+                      int32_t flag_count)
+{
+  initialize_rewriter_type();
+  JanetRewriter* rewriter = (JanetRewriter*)janet_abstract(&rewriter_type, sizeof(JanetRewriter));
+  rewriter->regex         = nullptr;
+  rewriter->templates     = templates;
+  rewriter->rules         = nullptr;
+  rewriter->error         = nullptr;
+
+  std::vector<Janet>       all_flags(flags, flags + flag_count);
+  std::vector<RewriteRule> rules;
+  std::string              error;
+  if (patterns.empty())
+  {
+    rewriter->error = new std::string("rewriter needs at least one rule");
+    return rewriter;
+  }
+  if (!check_rules(patterns, templates, all_flags, rules, error))
+  {
+    rewriter->error = new std::string(error);
+    return rewriter;
+  }
+
+  auto  combined = combine_rules(patterns);
+  auto* regex    = new_abstract_pcre2_regex(combined.c_str(), all_flags.data(), 0, (int32_t)all_flags.size());
+  if (!regex->re)
+  {
+    rewriter->error = new std::string(*regex->pattern);
+    return rewriter;
+  }
+  if (regex->dfa)
+  {
+    // pcre2_dfa_match does not record marks
+    rewriter->error = new std::string("rewriter rules cannot use :dfa or :shortest");
+    return rewriter;
+  }
+  rewriter->regex = regex;
+  rewriter->rules = new std::vector<RewriteRule>(std::move(rules));
+  regex_account(regex);
+  janet_gcpressure(regex->memory);
+  return rewriter;
+}
+
+bool
+rewriter_rewrite(const JanetRewriter* rewriter, const char* subject, size_t length, JanetBuffer* out,
+                 std::string& error)
+{
+  const std::vector<RewriteRule>& rules = *rewriter->rules;
+  std::vector<size_t>             spans;
+  PCRE2MatchIterator              matcher(rewriter->regex);
+  matcher.reset(subject, length, 0);
+
+  size_t last = 0;
+  while (matcher.next())
+  {
+    // a rule with its own (*MARK) would hide the rule number
+    const char* mark     = matcher.mark();
+    char*       mark_end = nullptr;
+    size_t      number   = mark ? strtoul(mark, &mark_end, 10) : 0;
+    if (!mark || *mark_end != '\0' || number >= rules.size())
+    {
+      error = "rewriter rules cannot use their own (*MARK) names";
+      return false;
+    }
+
+    // the rule's groups, renumbered from 1 for its template
+    const RewriteRule& rule  = rules[number];
+    const size_t*      found = matcher.spans();
+    int                count = matcher.count();
+    spans.assign(found, found + 2);
+    for (int group = rule.offset + 1; group <= rule.offset + rule.captures; ++group)
+    {
+      bool set = group < count;
+      spans.push_back(set ? found[2 * group] : SIZE_MAX);
+      spans.push_back(set ? found[2 * group + 1] : SIZE_MAX);
+    }
+
+    if (found[0] > last)
+      janet_buffer_push_bytes(out, (const uint8_t*)subject + last, (int32_t)(found[0] - last));
+    TemplateAppend(rule.tmpl, rule.named, subject, length, spans.data(), rule.captures + 1, out);
+    last = found[1] > last ? found[1] : last;
+  }
+
+  error = matcher.error();
+  if (!error.empty())
+    return false;
+
+  if (length > last)
+    janet_buffer_push_bytes(out, (const uint8_t*)subject + last, (int32_t)(length - last));
+  return true;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <janet.h>
+
+#include <string>
+#include <vector>
+
+#include "template.h"
+#include "wrap_pcre2.h"
+
+// An ordered list of [pattern replacement] rules applied in one pass over
+// the text, rather than one jre/replace-all per rule with a new string
+// each time. The rules are compiled into one PCRE2 alternation,
+//
+//   (?J)(*MARK:0)(?:rule0)|(*MARK:1)(?:rule1)|...
+//
+// so each match is the leftmost of any rule, and of the rules matching
+// there the first, and the mark names which rule it was. Its replacement is
+// expanded with the rule's own group numbers and names, and everything goes
+// into a single buffer.
+//
+// Unlike applying the rules one after another, text a rule has replaced is
+// not seen by the rules after it.
+
+// Where one rule's groups are in the combined pattern.
+struct RewriteRule
+{
+  const JanetTemplate* tmpl     = nullptr;
+  std::vector<int>     named;        // group numbers of tmpl's named segments, within the rule
+  int                  offset   = 0; // groups of the rules before this one
+  int                  captures = 0;
+};
+
+struct JanetRewriter
+{
+  JanetGCObject             gc;
+  JanetPCRE2Regex*          regex     = nullptr; // the combined pattern
+  JanetTuple                templates = nullptr; // the replacement for each rule
+  std::vector<RewriteRule>* rules     = nullptr;
+  std::string*              error     = nullptr;
+};
+
+extern JanetAbstractType rewriter_type;
+
+// Compile the rules. `templates` holds a parsed template for each pattern,
+// and `flags` are PCRE2 compile flags applied to every rule. On failure
+// `regex` is null and `error` holds the message.
+JanetRewriter* new_abstract_rewriter(const std::vector<std::string>& patterns, JanetTuple templates,
+                                     const Janet* flags, int32_t flag_count);
+
+int  rewriter_gc(void* data, size_t len);
+int  rewriter_gcmark(void* data, size_t len);
+void rewriter_tostring(void* data, JanetBuffer* buffer);
+
+// Append subject with every match replaced to out. Returns false with a
+// message in error when matching fails.
+bool rewriter_rewrite(const JanetRewriter* rewriter, const char* subject, size_t length, JanetBuffer* out,
+                      std::string& error);
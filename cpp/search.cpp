@@ -0,0 +1,286 @@
+#include "search.h"
+
+#include "mapped_file.h"
+#include "wrap_pcre2.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+namespace
+{
+struct SearchTask
+{
+  std::string path;
+  bool        directory = false;
+};
+
+class TaskQueue
+{
+public:
+  void push(SearchTask task)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tasks.push_back(std::move(task));
+  }
+
+  // The owner works depth first from the back, thieves take the oldest
+  // task, usually a directory near the top of the tree, from the front.
+  bool pop(SearchTask& task, bool steal)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_tasks.empty())
+      return false;
+    if (steal)
+    {
+      task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+    }
+    else
+    {
+      task = std::move(m_tasks.back());
+      m_tasks.pop_back();
+    }
+    return true;
+  }
+
+private:
+  std::mutex             m_mutex;
+  std::deque<SearchTask> m_tasks;
+};
+
+struct SearchState
+{
+  const JanetRegex*                       regex = nullptr;
+  std::vector<std::unique_ptr<TaskQueue>> queues;
+  std::atomic<size_t>                     pending{ 0 }; // tasks queued or running
+  std::atomic<bool>                       failed{ false };
+  std::mutex                              error_mutex;
+  std::string                             error;
+
+  void push(size_t worker, SearchTask task)
+  {
+    ++pending;
+    queues[worker]->push(std::move(task));
+  }
+
+  void fail(const std::string& message)
+  {
+    std::lock_guard<std::mutex> lock(error_mutex);
+    if (!failed.exchange(true))
+      error = message;
+  }
+};
+
+#ifdef _WIN32
+const char path_separator = '\\';
+#else
+const char path_separator = '/';
+#endif
+
+std::string
+join_path(const std::string& dir, const char* name)
+{
+  if (!dir.empty() && (dir.back() == '/' || dir.back() == path_separator))
+    return dir + name;
+  return dir + path_separator + name;
+}
+
+// Whether path exists, and if so whether it is a directory.
+bool
+stat_path(const std::string& path, bool& directory)
+{
+#ifdef _WIN32
+  DWORD attributes = GetFileAttributesA(path.c_str());
+  if (attributes == INVALID_FILE_ATTRIBUTES)
+    return false;
+  directory = (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+    return false;
+  directory = S_ISDIR(st.st_mode);
+#endif
+  return true;
+}
+
+// Queue the regular files and directories in dir on worker's own queue.
+// Links to files are queued as files, links to directories are not
+// followed.
+void
+list_directory(SearchState& state, size_t worker, const std::string& dir)
+{
+#ifdef _WIN32
+  WIN32_FIND_DATAA entry;
+  HANDLE           find = FindFirstFileA(join_path(dir, "*").c_str(), &entry);
+  if (find == INVALID_HANDLE_VALUE)
+    return;
+  do
+  {
+    if (!strcmp(entry.cFileName, ".") || !strcmp(entry.cFileName, ".."))
+      continue;
+    std::string path = join_path(dir, entry.cFileName);
+    if (entry.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+    {
+      // the link's own attributes say nothing about its target
+      DWORD target = GetFileAttributesA(path.c_str());
+      if (target != INVALID_FILE_ATTRIBUTES && !(target & FILE_ATTRIBUTE_DIRECTORY))
+        state.push(worker, { std::move(path), false });
+      continue;
+    }
+    state.push(worker, { std::move(path), (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0 });
+  } while (FindNextFileA(find, &entry));
+  FindClose(find);
+#else
+  DIR* d = opendir(dir.c_str());
+  if (!d)
+    return;
+  while (struct dirent* entry = readdir(d))
+  {
+    const char* name = entry->d_name;
+    if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+      continue;
+    std::string path = join_path(dir, name);
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0)
+      continue;
+    if (S_ISLNK(st.st_mode))
+    {
+      if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+        state.push(worker, { std::move(path), false });
+    }
+    else if (S_ISDIR(st.st_mode))
+      state.push(worker, { std::move(path), true });
+    else if (S_ISREG(st.st_mode))
+      state.push(worker, { std::move(path), false });
+  }
+  closedir(d);
+#endif
+}
+
+void
+search_file(SearchState& state, RegexMatcher& matcher, const std::string& path, std::vector<SearchHit>& hits)
+{
+  MappedFile file(path);
+  if (!file.ok())
+    return;
+
+  std::vector<size_t> offsets;
+  matcher.reset(file.data(), file.length(), 0);
+  while (matcher.next())
+    offsets.push_back(matcher.spans()[0]);
+
+  std::string error = matcher.error();
+  if (!error.empty())
+    state.fail(path + ": " + error);
+  else if (!offsets.empty())
+    hits.push_back({ path, std::move(offsets) });
+}
+
+void
+search_worker(SearchState& state, size_t self, std::vector<SearchHit>& hits)
+{
+  RegexMatcherPtr matcher = regex_matcher(state.regex, false);
+  size_t          workers = state.queues.size();
+  SearchTask      task;
+  while (!state.failed)
+  {
+    bool found = state.queues[self]->pop(task, false);
+    for (size_t i = 1; !found && i < workers; ++i)
+      found = state.queues[(self + i) % workers]->pop(task, true);
+    if (!found)
+    {
+      // others may still be listing directories
+      if (state.pending == 0)
+        break;
+      std::this_thread::yield();
+      continue;
+    }
+    if (task.directory)
+      list_directory(state, self, task.path);
+    else
+      search_file(state, *matcher, task.path, hits);
+    --state.pending;
+  }
+}
+
+// PCRE2 regexes matched by pcre2_dfa_match keep their workspace on the
+// regex, and :trace regexes their counts, so only one thread may use them.
+bool
+shares_state(const JanetRegex* regex)
+{
+  if (regex->engine != &pcre2_engine)
+    return false;
+  auto* pcre2 = static_cast<const JanetPCRE2Regex*>(regex);
+  return pcre2->dfa || pcre2->trace;
+}
+}
+
+bool
+search_paths(const JanetRegex* regex, const std::vector<std::string>& paths, size_t threads,
+             std::vector<SearchHit>& hits, std::string& error)
+{
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  if (shares_state(regex))
+    threads = 1;
+
+  SearchState state;
+  state.regex = regex;
+  for (size_t i = 0; i < threads; ++i)
+    state.queues.emplace_back(new TaskQueue());
+
+  // the paths given are dealt out in turn, everything below them is stolen
+  for (size_t i = 0; i < paths.size(); ++i)
+  {
+    bool directory = false;
+    if (!stat_path(paths[i], directory))
+    {
+      error = "no such file or directory: " + paths[i];
+      return false;
+    }
+    state.push(i % threads, { paths[i], directory });
+  }
+
+  std::vector<std::vector<SearchHit>> found(threads);
+  std::vector<std::thread>            workers;
+  for (size_t i = 1; i < threads; ++i)
+  {
+    // without a thread its queue is left for the others to steal from
+    try
+    {
+      workers.emplace_back(search_worker, std::ref(state), i, std::ref(found[i]));
+    }
+    catch (const std::system_error&)
+    {
+      break;
+    }
+  }
+  search_worker(state, 0, found[0]);
+  for (auto& worker : workers)
+    worker.join();
+
+  if (state.failed)
+  {
+    error = state.error;
+    return false;
+  }
+
+  for (auto& list : found)
+    std::move(list.begin(), list.end(), std::back_inserter(hits));
+  std::sort(hits.begin(), hits.end(), [](const SearchHit& a, const SearchHit& b) { return a.path < b.path; });
+  return true;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "regex.h"
+
+// Searching many files at once for jre/search-paths. Paths are tasks on
+// per-worker queues: a worker takes from the back of its own queue, lists
+// directories onto it, and when it runs dry steals from the front of the
+// others, so one large directory is spread over every thread. Each worker
+// has its own matcher and reads files through a read-only memory map.
+
+// A file with at least one match, and the begin offset of every match.
+struct SearchHit
+{
+  std::string         path;
+  std::vector<size_t> offsets;
+};
+
+// Search the files in paths, and every regular file below the directories
+// in it, with up to threads workers (0 for one per core). Symbolic links
+// to directories are not followed and unreadable entries are skipped. Hits
+// are sorted by path. Returns false with a message in error when a path
+// does not exist or the engine fails on a file.
+bool search_paths(const JanetRegex* regex, const std::vector<std::string>& paths, size_t threads,
+                  std::vector<SearchHit>& hits, std::string& error);
@@ -0,0 +1,289 @@
+#include "template.h"
+
+#include <sstream>
+
+namespace
+{
+// larger group numbers are cut short, and then fail the capture count check
+const int max_group = 65535;
+
+void
+push_literal(JanetTemplate* tmpl, const char* text, size_t len)
+{
+  auto& segments = *tmpl->segments;
+  auto  begin    = tmpl->literals->size();
+  tmpl->literals->append(text, len);
+  // merge with a preceding literal, e.g. text before a `$$`
+  if (!segments.empty() && segments.back().kind == TemplateSegmentKind::Literal && segments.back().end == begin)
+  {
+    segments.back().end = tmpl->literals->size();
+    return;
+  }
+  TemplateSegment segment;
+  segment.begin = begin;
+  segment.end   = tmpl->literals->size();
+  segments.push_back(segment);
+}
+
+void
+push_group(JanetTemplate* tmpl, int group)
+{
+  TemplateSegment segment;
+  segment.kind  = TemplateSegmentKind::Group;
+  segment.group = group;
+  tmpl->segments->push_back(segment);
+  if (group > tmpl->maxGroup)
+    tmpl->maxGroup = group;
+}
+
+bool
+parse_template(JanetTemplate* tmpl, const char* input, std::string& error)
+{
+  size_t len = strlen(input);
+  size_t i   = 0;
+  size_t lit = 0; // start of pending literal text
+  while (i < len)
+  {
+    if (input[i] != '$')
+    {
+      ++i;
+      continue;
+    }
+    if (i > lit)
+      push_literal(tmpl, input + lit, i - lit);
+
+    size_t dollar = i++;
+    if (i >= len)
+    {
+      error = "trailing $ in replacement template";
+      return false;
+    }
+
+    char c = input[i];
+    if (c == '$')
+    {
+      push_literal(tmpl, "$", 1);
+      ++i;
+    }
+    else if (c == '&')
+    {
+      push_group(tmpl, 0);
+      ++i;
+    }
+    else if (c == '`' || c == '\'')
+    {
+      TemplateSegment segment;
+      segment.kind = c == '`' ? TemplateSegmentKind::Prefix : TemplateSegmentKind::Suffix;
+      tmpl->segments->push_back(segment);
+      ++i;
+    }
+    else if (c >= '0' && c <= '9')
+    {
+      int group = 0;
+      while (i < len && input[i] >= '0' && input[i] <= '9' && group < max_group)
+        group = group * 10 + (input[i++] - '0');
+      push_group(tmpl, group);
+    }
+    else if (c == '{')
+    {
+      size_t close = i + 1;
+      while (close < len && input[close] != '}')
+        ++close;
+      if (close >= len || close == i + 1)
+      {
+        std::ostringstream os;
+        os << "unterminated or empty ${} at offset " << dollar << " in replacement template";
+        error = os.str();
+        return false;
+      }
+      std::string ref(input + i + 1, close - i - 1);
+      if (ref.find_first_not_of("0123456789") == std::string::npos)
+      {
+        int group = 0;
+        for (size_t j = 0; j < ref.size() && group < max_group; ++j)
+          group = group * 10 + (ref[j] - '0');
+        push_group(tmpl, group);
+      }
+      else
+      {
+        TemplateSegment segment;
+        segment.kind = TemplateSegmentKind::Named;
+        segment.name = ref;
+        tmpl->segments->push_back(segment);
+      }
+      i = close + 1;
+    }
+    else
+    {
+      std::ostringstream os;
+      os << "invalid escape '$" << c << "' at offset " << dollar << " in replacement template";
+      error = os.str();
+      return false;
+    }
+    lit = i;
+  }
+  if (len > lit)
+    push_literal(tmpl, input + lit, len - lit);
+  return true;
+}
+}
+
+int
+template_gc(void* data, size_t len)
+{
+  (void)len;
+  if (data)
+  {
+    JanetTemplate* tmpl = (JanetTemplate*)data;
+    if (tmpl->source)
+    {
+      delete (tmpl->source);
+      tmpl->source = nullptr;
+    }
+    if (tmpl->literals)
+    {
+      delete (tmpl->literals);
+      tmpl->literals = nullptr;
+    }
+    if (tmpl->segments)
+    {
+      delete (tmpl->segments);
+      tmpl->segments = nullptr;
+    }
+  }
+  return 0;
+}
+
+int
+template_gcmark(void* data, size_t len)
+{
+  (void)len;
+  janet_mark(janet_wrap_abstract((JanetTemplate*)data));
+  return 0;
+}
+
+void
+template_tostring(void* data, JanetBuffer* buffer)
+{
+  if (data)
+  {
+    JanetTemplate* tmpl = (JanetTemplate*)data;
+    if (!tmpl->source)
+    {
+      janet_buffer_push_cstring(buffer, "no template");
+      return;
+    }
+    janet_buffer_push_cstring(buffer, "template: '");
+    janet_buffer_push_cstring(buffer, tmpl->source->c_str());
+    janet_buffer_push_cstring(buffer, "'");
+  }
+}
+
+JanetAbstractType template_type = {};
+
+void
+initialize_template_type()
+{
+  if (!template_type.name)
+  {
+    template_type.name     = "jre-template";
+    template_type.gc       = template_gc;
+    template_type.gcmark   = template_gcmark;
+    template_type.tostring = template_tostring;
+  }
+}
+
+namespace
+{
+void
+init_template(JanetTemplate* tmpl, const char* input)
+{
+  tmpl->source   = nullptr;
+  tmpl->literals = new std::string();
+  tmpl->segments = new std::vector<TemplateSegment>();
+  tmpl->maxGroup = 0;
+
+  std::string error;
+  if (parse_template(tmpl, input, error))
+  {
+    tmpl->source = new std::string(input);
+  }
+  else
+  {
+    delete (tmpl->segments);
+    tmpl->segments = nullptr;
+    tmpl->source   = new std::string(error);
+  }
+}
+}
+
+JanetTemplate*
+new_abstract_template(const char* input)
+{
+  initialize_template_type();
+  JanetTemplate* tmpl = (JanetTemplate*)janet_abstract(&template_type, sizeof(JanetTemplate));
+  init_template(tmpl, input);
+  return tmpl;
+}
+
+TemplateCache::~TemplateCache()
+{
+  template_gc(&m_template, 0);
+}
+
+const JanetTemplate*
+TemplateCache::parse(const char* input, std::string& error)
+{
+  if (!m_template.segments || *m_template.source != input)
+  {
+    template_gc(&m_template, 0);
+    init_template(&m_template, input);
+  }
+  if (!m_template.segments)
+  {
+    error = *m_template.source;
+    return nullptr;
+  }
+  return &m_template;
+}
+
+void
+TemplateExpand(const JanetTemplate* tmpl, const std::vector<int>& named, const char* subject, size_t length,
+               const size_t* spans, int count, const TemplateWriter& write)
+{
+  size_t nextNamed = 0;
+  for (auto&& segment : *tmpl->segments)
+  {
+    int group = -1;
+    switch (segment.kind)
+    {
+    case TemplateSegmentKind::Literal:
+      write(tmpl->literals->data() + segment.begin, segment.end - segment.begin);
+      continue;
+    case TemplateSegmentKind::Prefix:
+      write(subject, spans[0]);
+      continue;
+    case TemplateSegmentKind::Suffix:
+      write(subject + spans[1], length - spans[1]);
+      continue;
+    case TemplateSegmentKind::Group:
+      group = segment.group;
+      break;
+    case TemplateSegmentKind::Named:
+      group = named[nextNamed++];
+      break;
+    }
+    // groups that did not participate expand to nothing
+    if (group < count && spans[2 * group] != SIZE_MAX)
+      write(subject + spans[2 * group], spans[2 * group + 1] - spans[2 * group]);
+  }
+}
+
+void
+TemplateAppend(const JanetTemplate* tmpl, const std::vector<int>& named, const char* subject, size_t length,
+               const size_t* spans, int count, JanetBuffer* out)
+{
+  TemplateExpand(tmpl, named, subject, length, spans, count, [out](const char* data, size_t size) {
+    janet_buffer_push_bytes(out, (const uint8_t*)data, (int32_t)size);
+  });
+}
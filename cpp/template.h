@@ -0,0 +1,90 @@
+#pragma once
+
+#include <janet.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// A replacement template parsed once into literal and group-reference
+// segments, so repeated replace calls do not re-parse `$1`/`${name}`.
+//
+// Syntax, shared by both engines:
+//   $$          literal $
+//   $0, $&      the whole match
+//   $n, ${n}    capture group n
+//   ${name}     named capture group (PCRE2 only)
+//   $`, $'      text before / after the match
+
+enum class TemplateSegmentKind
+{
+  Literal,
+  Group,
+  Named,
+  Prefix,
+  Suffix
+};
+
+struct TemplateSegment
+{
+  TemplateSegmentKind kind  = TemplateSegmentKind::Literal;
+  size_t              begin = 0; // literal text, offsets into JanetTemplate::literals
+  size_t              end   = 0;
+  int                 group = 0;  // group number for Group segments
+  std::string         name  = ""; // group name for Named segments
+};
+
+struct JanetTemplate
+{
+  JanetGCObject                 gc;
+  std::string*                  source   = nullptr;
+  std::string*                  literals = nullptr;
+  std::vector<TemplateSegment>* segments = nullptr;
+  int                           maxGroup = 0; // highest numbered group referenced
+};
+
+extern JanetAbstractType template_type;
+
+// Parse `input` into a new template abstract. On a syntax error `segments`
+// is null and `source` holds the error message.
+JanetTemplate* new_abstract_template(const char* input);
+
+// The template parsed from the last replacement string, for engines whose
+// own replacement syntax is the template syntax, so calling replace again
+// with the same string does not parse it again. Not a GC object, it is
+// owned by the regex and only used by calls on the regex's thread.
+class TemplateCache
+{
+public:
+  TemplateCache() = default;
+  ~TemplateCache();
+
+  TemplateCache(const TemplateCache&)            = delete;
+  TemplateCache& operator=(const TemplateCache&) = delete;
+
+  // The template for input, valid until the next call. Null with the
+  // message in error if input does not parse.
+  const JanetTemplate* parse(const char* input, std::string& error);
+
+private:
+  JanetTemplate m_template = {};
+};
+
+int  template_gc(void* data, size_t len);
+int  template_gcmark(void* data, size_t len);
+void template_tostring(void* data, JanetBuffer* buffer);
+
+// Receives the expansion of a template a run of bytes at a time.
+using TemplateWriter = std::function<void(const char* data, size_t length)>;
+
+// Pass the expansion of `tmpl` for one match to write, in order: literal
+// text from the template, and groups, $` and $' straight from subject, so
+// a caller streaming the result never holds a whole expansion.
+void TemplateExpand(const JanetTemplate* tmpl, const std::vector<int>& named, const char* subject, size_t length,
+                    const size_t* spans, int count, const TemplateWriter& write);
+
+// Append the expansion of `tmpl` for one match to `out`. `spans` holds
+// `count` begin/end pairs for the match and its groups, with SIZE_MAX for
+// unset groups. `named` maps each Named segment, in order, to a group index.
+void TemplateAppend(const JanetTemplate* tmpl, const std::vector<int>& named, const char* subject, size_t length,
+                    const size_t* spans, int count, JanetBuffer* out);
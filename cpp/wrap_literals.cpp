@@ -0,0 +1,222 @@
+#include "wrap_literals.h"
+
+#include <cstring>
+#include <sstream>
+
+namespace
+{
+const char* literals_allowed = "[:ignorecase]";
+const char* ignorecase       = "ignorecase";
+
+// Set up regex, allocated as a regex_type abstract, from input and flags.
+void
+init_literals_regex(JanetLiteralsRegex* regex, const char* input, const Janet* argv, int32_t flag_start,
+                    int32_t argc)
+{
+  regex->engine    = &literals_engine;
+  regex->re        = nullptr;
+  regex->templates = nullptr;
+  regex->pattern   = nullptr;
+  regex->flags     = new std::vector<std::string>();
+  regex->prefilter = nullptr;
+  regex->memory    = 0;
+  bool caseless    = false;
+
+  for (int32_t i = flag_start; i < argc; ++i)
+  {
+    if (!janet_checktype(argv[i], JANET_KEYWORD) || janet_unwrap_keyword(argv[i]) != janet_ckeyword(ignorecase))
+    {
+      std::ostringstream os;
+      os << "literals flags must be keywords from " << literals_allowed;
+      regex->pattern = new std::string(os.str());
+      return;
+    }
+    caseless = true;
+    regex->flags->push_back(ignorecase);
+  }
+
+  if (input)
+  {
+    // one literal per line, blank lines are skipped by the build
+    std::vector<std::string> literals;
+    for (const char* line = input;;)
+    {
+      const char* newline = strchr(line, '\n');
+      if (!newline)
+      {
+        literals.emplace_back(line);
+        break;
+      }
+      literals.emplace_back(line, newline - line);
+      line = newline + 1;
+    }
+    regex->re = new LiteralSet();
+    regex->re->build(literals, caseless);
+    regex->pattern = new std::string(input);
+  }
+}
+}
+
+JanetLiteralsRegex*
+new_abstract_literals_regex(const char* input, const Janet* argv, int32_t flag_start, int32_t argc)
+{
+  initialize_regex_type();
+  JanetLiteralsRegex* regex = (JanetLiteralsRegex*)janet_abstract(&regex_type, sizeof(JanetLiteralsRegex));
+  init_literals_regex(regex, input, argv, flag_start, argc);
+  return regex;
+}
+
+namespace
+{
+// Matches never overlap or are empty, so each search starts where the last
+// match ended.
+class LiteralsMatcher : public RegexMatcher
+{
+public:
+  explicit LiteralsMatcher(const LiteralSet& set) : m_set(set) {}
+
+  void
+  reset(const char* subject, size_t length, size_t start) override
+  {
+    m_subject = subject;
+    m_length  = length;
+    m_pos     = start;
+  }
+
+  bool
+  next() override
+  {
+    if (!m_set.search(m_subject, m_length, m_pos, m_spans[0], m_spans[1]))
+    {
+      m_pos = SIZE_MAX;
+      return false;
+    }
+    m_pos = m_spans[1];
+    return true;
+  }
+
+  const size_t*
+  spans() const override
+  {
+    return m_spans;
+  }
+
+  int
+  count() const override
+  {
+    return 1;
+  }
+
+  std::string
+  error() const override
+  {
+    return "";
+  }
+
+private:
+  const LiteralSet& m_set;
+  const char*       m_subject  = nullptr;
+  size_t            m_length   = 0;
+  size_t            m_pos      = 0;
+  size_t            m_spans[2] = { 0, 0 };
+};
+
+JanetRegex*
+literals_engine_compile(const char* pattern, const Janet* argv, int32_t flag_start, int32_t argc, std::string& error)
+{
+  JanetLiteralsRegex* regex = new_abstract_literals_regex(pattern, argv, flag_start, argc);
+  return regex_compiled(regex, regex->re != nullptr, error);
+}
+
+void
+literals_engine_release(JanetRegex* base)
+{
+  JanetLiteralsRegex* re = static_cast<JanetLiteralsRegex*>(base);
+  if (re->re)
+  {
+    delete (re->re);
+    re->re = nullptr;
+  }
+  if (re->templates)
+  {
+    delete (re->templates);
+    re->templates = nullptr;
+  }
+}
+
+int
+literals_engine_captures(const JanetRegex* base)
+{
+  (void)base;
+  return 0;
+}
+
+void
+literals_engine_info(const JanetRegex* base, JanetTable* info)
+{
+  const JanetLiteralsRegex* regex = static_cast<const JanetLiteralsRegex*>(base);
+  janet_table_put(info, janet_ckeywordv("literals"), janet_wrap_number((double)regex->re->literals()));
+  janet_table_put(info, janet_ckeywordv("states"), janet_wrap_number((double)regex->re->states()));
+}
+
+RegexMatcherPtr
+literals_engine_matcher(const JanetRegex* base, bool any)
+{
+  (void)any;
+  return RegexMatcherPtr(new LiteralsMatcher(*static_cast<const JanetLiteralsRegex*>(base)->re));
+}
+
+// plain replacement strings use the template syntax, parsed again only
+// when the string changes
+bool
+literals_engine_substitute(const JanetRegex* base, const char* subject, size_t length, const char* subst, bool all,
+                           JanetBuffer* out, std::string& error)
+{
+  const JanetLiteralsRegex* regex = static_cast<const JanetLiteralsRegex*>(base);
+  if (!regex->templates)
+    regex->templates = new TemplateCache();
+  const JanetTemplate* tmpl = regex->templates->parse(subst, error);
+  return tmpl && regex_replace_template(regex, subject, length, tmpl, all, out, error);
+}
+
+bool
+literals_engine_restore(JanetRegex* base, const char* pattern, const Janet* argv, int32_t argc,
+                        const std::string& serialized)
+{
+  (void)serialized;
+  JanetLiteralsRegex* regex = static_cast<JanetLiteralsRegex*>(base);
+  init_literals_regex(regex, pattern, argv, 0, argc);
+  return regex->re != nullptr;
+}
+
+// a literal is found from its own bytes alone
+size_t
+literals_engine_lookbehind(const JanetRegex* regex)
+{
+  (void)regex;
+  return 0;
+}
+
+size_t
+literals_engine_memory(const JanetRegex* base)
+{
+  const JanetLiteralsRegex* regex = static_cast<const JanetLiteralsRegex*>(base);
+  return regex->re ? regex->re->memory() : 0;
+}
+}
+
+const RegexEngine literals_engine = {
+  "literals",
+  literals_engine_compile,
+  literals_engine_release,
+  literals_engine_captures,
+  literals_engine_info,
+  literals_engine_matcher,
+  literals_engine_substitute,
+  nullptr, // no groups
+  sizeof(JanetLiteralsRegex),
+  literals_engine_restore,
+  nullptr, // rebuilt from the literals
+  literals_engine_lookbehind,
+  literals_engine_memory,
+};
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <janet.h>
+
+#include "literals.h"
+#include "regex.h"
+
+// A dictionary of literal strings matched with an Aho-Corasick automaton.
+// The pattern is the literals, one per line.
+struct JanetLiteralsRegex : JanetRegex
+{
+  LiteralSet*            re        = nullptr;
+  mutable TemplateCache* templates = nullptr; // the last replacement string, made on first replace
+};
+
+extern const RegexEngine literals_engine;
+
+// On failure `re` is null and `pattern` holds the error message.
+JanetLiteralsRegex* new_abstract_literals_regex(const char* input, const Janet* argv, int32_t flag_start,
+                                                int32_t argc);
@@ -0,0 +1,283 @@
+#include "wrap_nfa.h"
+
+#include <sstream>
+
+namespace
+{
+const char* nfa_allowed = "[:ignorecase :multiline :dotall]";
+
+struct NFAFlag
+{
+  const char* name;
+  uint32_t    options;
+};
+
+const NFAFlag nfa_flags[] = {
+  { "ignorecase", NFA_IGNORECASE },
+  { "multiline", NFA_MULTILINE },
+  { "dotall", NFA_DOTALL },
+};
+
+const NFAFlag*
+get_nfa_flag(JanetKeyword kw)
+{
+  for (auto&& flag : nfa_flags)
+  {
+    if (kw == janet_ckeyword(flag.name))
+      return &flag;
+  }
+  return nullptr;
+}
+}
+
+namespace
+{
+// Set up regex, allocated as a regex_type abstract, from input and flags.
+void
+init_nfa_regex(JanetNFARegex* regex, const char* input, const Janet* argv, int32_t flag_start, int32_t argc)
+{
+  regex->engine        = &nfa_engine;
+  regex->re            = nullptr;
+  regex->matcher       = nullptr;
+  regex->matcher_busy  = false;
+  regex->templates     = nullptr;
+  regex->pattern       = nullptr;
+  regex->flags         = new std::vector<std::string>();
+  regex->prefilter     = nullptr;
+  regex->memory        = 0;
+  uint32_t options     = 0;
+
+  for (int32_t i = flag_start; i < argc; ++i)
+  {
+    const NFAFlag* flag = nullptr;
+    if (janet_checktype(argv[i], JANET_KEYWORD))
+      flag = get_nfa_flag(janet_unwrap_keyword(argv[i]));
+    if (!flag)
+    {
+      std::ostringstream os;
+      os << "NFA regex flags must be keywords from " << nfa_allowed;
+      regex->pattern = new std::string(os.str());
+      return;
+    }
+    options |= flag->options;
+    regex->flags->push_back(flag->name);
+  }
+
+  if (input)
+  {
+    auto*       re = new NFAProgram();
+    std::string error;
+    if (re->compile(input, options, error))
+    {
+      regex->re      = re;
+      regex->matcher = new NFAMatcher(*re);
+      regex->pattern = new std::string(input);
+      if (options & NFA_IGNORECASE)
+        regex->prefilter = caseless_prefilter(input, false);
+    }
+    else
+    {
+      delete re;
+      regex->pattern = new std::string(error);
+    }
+  }
+}
+}
+
+JanetNFARegex*
+new_abstract_nfa_regex(const char* input, const Janet* argv, int32_t flag_start, int32_t argc)
+{
+  initialize_regex_type();
+  JanetNFARegex* regex = (JanetNFARegex*)janet_abstract(&regex_type, sizeof(JanetNFARegex));
+  init_nfa_regex(regex, input, argv, flag_start, argc);
+  return regex;
+}
+
+namespace
+{
+// Walks matches with the regex's scratch matcher, or a matcher of its own
+// when that one is taken, e.g. by replace-with running the same regex from
+// its callback. After an empty match, like PCRE2, a non-empty match at the
+// same place is tried before moving on a byte.
+class NFARegexMatcher : public RegexMatcher
+{
+public:
+  explicit NFARegexMatcher(const JanetNFARegex* regex) : m_regex(regex), m_matcher(regex->matcher)
+  {
+    // claimed atomically, jre/search-paths walks one regex from many threads
+    if (regex->matcher_busy.exchange(true))
+    {
+      m_owned.reset(new NFAMatcher(*regex->re));
+      m_matcher = m_owned.get();
+    }
+  }
+
+  ~NFARegexMatcher() override
+  {
+    if (!m_owned)
+      m_regex->matcher_busy = false;
+  }
+
+  void
+  reset(const char* subject, size_t length, size_t start) override
+  {
+    m_subject = subject;
+    m_length  = length;
+    m_pos     = start;
+    m_empty   = false;
+  }
+
+  bool
+  next() override
+  {
+    if (m_empty)
+    {
+      m_empty = false;
+      if (m_matcher->search(m_subject, m_length, m_pos, true))
+      {
+        m_pos = m_matcher->spans()[1];
+        return true;
+      }
+      ++m_pos;
+    }
+    if (m_pos > m_length || !m_matcher->search(m_subject, m_length, m_pos))
+    {
+      m_pos = SIZE_MAX;
+      return false;
+    }
+    const size_t* spans = m_matcher->spans();
+    m_pos               = spans[1];
+    m_empty             = spans[1] == spans[0];
+    return true;
+  }
+
+  const size_t*
+  spans() const override
+  {
+    return m_matcher->spans();
+  }
+
+  int
+  count() const override
+  {
+    return m_matcher->count();
+  }
+
+  std::string
+  error() const override
+  {
+    return "";
+  }
+
+private:
+  const JanetNFARegex*        m_regex;
+  NFAMatcher*                 m_matcher;
+  std::unique_ptr<NFAMatcher> m_owned;
+  const char*                 m_subject = nullptr;
+  size_t                      m_length  = 0;
+  size_t                      m_pos     = 0;
+  bool                        m_empty   = false; // the last match was empty, at m_pos
+};
+
+JanetRegex*
+nfa_engine_compile(const char* pattern, const Janet* argv, int32_t flag_start, int32_t argc, std::string& error)
+{
+  JanetNFARegex* regex = new_abstract_nfa_regex(pattern, argv, flag_start, argc);
+  return regex_compiled(regex, regex->re != nullptr, error);
+}
+
+void
+nfa_engine_release(JanetRegex* base)
+{
+  JanetNFARegex* re = static_cast<JanetNFARegex*>(base);
+  if (re->matcher)
+  {
+    delete (re->matcher);
+    re->matcher = nullptr;
+  }
+  if (re->re)
+  {
+    delete (re->re);
+    re->re = nullptr;
+  }
+  if (re->templates)
+  {
+    delete (re->templates);
+    re->templates = nullptr;
+  }
+}
+
+int
+nfa_engine_captures(const JanetRegex* base)
+{
+  return static_cast<const JanetNFARegex*>(base)->re->captures();
+}
+
+void
+nfa_engine_info(const JanetRegex* base, JanetTable* info)
+{
+  const JanetNFARegex* regex = static_cast<const JanetNFARegex*>(base);
+  janet_table_put(info, janet_ckeywordv("instructions"), janet_wrap_integer((int32_t)regex->re->size()));
+}
+
+RegexMatcherPtr
+nfa_engine_matcher(const JanetRegex* base, bool any)
+{
+  (void)any;
+  return RegexMatcherPtr(new NFARegexMatcher(static_cast<const JanetNFARegex*>(base)));
+}
+
+// plain replacement strings use the template syntax, parsed again only
+// when the string changes
+bool
+nfa_engine_substitute(const JanetRegex* base, const char* subject, size_t length, const char* subst, bool all,
+                      JanetBuffer* out, std::string& error)
+{
+  const JanetNFARegex* regex = static_cast<const JanetNFARegex*>(base);
+  if (!regex->templates)
+    regex->templates = new TemplateCache();
+  const JanetTemplate* tmpl = regex->templates->parse(subst, error);
+  return tmpl && regex_replace_template(regex, subject, length, tmpl, all, out, error);
+}
+
+bool
+nfa_engine_restore(JanetRegex* base, const char* pattern, const Janet* argv, int32_t argc, const std::string& serialized)
+{
+  (void)serialized;
+  JanetNFARegex* regex = static_cast<JanetNFARegex*>(base);
+  init_nfa_regex(regex, pattern, argv, 0, argc);
+  return regex->re != nullptr;
+}
+
+// ^ with :multiline and \b look at the byte before, there is no lookbehind
+size_t
+nfa_engine_lookbehind(const JanetRegex* regex)
+{
+  (void)regex;
+  return 1;
+}
+
+// the program, and the scratch matcher shared by calls
+size_t
+nfa_engine_memory(const JanetRegex* base)
+{
+  const JanetNFARegex* regex = static_cast<const JanetNFARegex*>(base);
+  return (regex->re ? regex->re->memory() : 0) + (regex->matcher ? regex->matcher->memory() : 0);
+}
+}
+
+const RegexEngine nfa_engine = {
+  "nfa",
+  nfa_engine_compile,
+  nfa_engine_release,
+  nfa_engine_captures,
+  nfa_engine_info,
+  nfa_engine_matcher,
+  nfa_engine_substitute,
+  nullptr, // no named groups
+  sizeof(JanetNFARegex),
+  nfa_engine_restore,
+  nullptr, // recompiled from the pattern
+  nfa_engine_lookbehind,
+  nfa_engine_memory,
+};
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <janet.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "nfa.h"
+#include "regex.h"
+
+struct JanetNFARegex : JanetRegex
+{
+  NFAProgram*               re           = nullptr;
+  NFAMatcher*               matcher      = nullptr; // scratch shared by calls on this regex
+  mutable std::atomic<bool> matcher_busy{ false };  // a walk is using matcher, others make their own
+  mutable TemplateCache*    templates    = nullptr; // the last replacement string, made on first replace
+};
+
+extern const RegexEngine nfa_engine;
+
+// On failure `re` is null and `pattern` holds the error message.
+JanetNFARegex* new_abstract_nfa_regex(const char* input, const Janet* argv, int32_t flag_start, int32_t argc);
@@ -1,116 +1,183 @@
 #include "wrap_pcre2.h"
-#include "results.h"
 
+#include "pool.h"
+
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <sstream>
 
 namespace
 {
-const char* pcre2_allowed = "[:ignorecase]";
-const char* ignorecase    = "ignorecase";
+const char* pcre2_allowed = "[:ignorecase :multiline :dotall :anchored :utf :no-utf-check :no-auto-capture "
+                            ":no-start-optimize :dfa :shortest :jit :trace]";
+const char* jit_allowed   = "[:complete :partial-soft :partial-hard :off]";
+const char* jit           = "jit";
+const char* trace         = "trace";
+
+// workspace sizes for pcre2_dfa_match, in ints. The workspace grows on
+// PCRE2_ERROR_DFA_WSSIZE and is kept on the regex for later calls.
+const size_t dfa_workspace_initial = 1000;
+const size_t dfa_workspace_max     = 1 << 20;
+
+struct PCRE2Flag
+{
+  const char* name;
+  uint32_t    compile_options; // passed to pcre2_compile
+  uint32_t    match_options;   // passed to every match and substitute call
+  bool        dfa;             // use pcre2_dfa_match
+};
+
+const PCRE2Flag pcre2_flags[] = {
+  { "ignorecase", PCRE2_CASELESS, 0, false },
+  { "multiline", PCRE2_MULTILINE, 0, false },
+  { "dotall", PCRE2_DOTALL, 0, false },
+  { "anchored", PCRE2_ANCHORED, 0, false },
+  { "utf", PCRE2_UTF, 0, false },
+  { "no-utf-check", 0, PCRE2_NO_UTF_CHECK, false },
+  { "no-auto-capture", PCRE2_NO_AUTO_CAPTURE, 0, false },
+  { "no-start-optimize", PCRE2_NO_START_OPTIMIZE, 0, false },
+  { "dfa", 0, 0, true },
+  { "shortest", 0, PCRE2_DFA_SHORTEST, true },
+};
+
+struct PCRE2JitMode
+{
+  const char* name;
+  uint32_t    options; // passed to pcre2_jit_compile, 0 to skip JIT
+};
+
+// partial modes also compile the complete variant, so ordinary matches
+// keep using JIT
+const PCRE2JitMode pcre2_jit_modes[] = {
+  { "complete", PCRE2_JIT_COMPLETE },
+  { "partial-soft", PCRE2_JIT_COMPLETE | PCRE2_JIT_PARTIAL_SOFT },
+  { "partial-hard", PCRE2_JIT_COMPLETE | PCRE2_JIT_PARTIAL_HARD },
+  { "off", 0 },
+};
+
+void*
+pool_allocate(PCRE2_SIZE size, void* pool)
+{
+  return ((SizeClassPool*)pool)->allocate(size);
+}
 
-uint32_t
-get_pcre2_flag_type(JanetKeyword kw)
+void
+pool_release(void* block, void* pool)
 {
-  if (kw == janet_ckeyword(ignorecase))
-  {
-    return PCRE2_CASELESS;
-  }
-  return 0;
+  ((SizeClassPool*)pool)->release(block);
 }
+
+// the compile context's defaults are those of a null one
+pcre2_compile_context*
+pool_compile_context()
+{
+  static pcre2_compile_context* context = pcre2_compile_context_create(pcre2_pool_context());
+  return context;
 }
 
+// Called by PCRE2 before each pattern item when compiled with
+// PCRE2_AUTO_CALLOUT. The backtrack flag is only reported by the
+// interpreter, which is why :trace regexes are not JIT compiled.
 int
-pcre2_set_gc(void* data, size_t len)
+trace_callout(pcre2_callout_block* block, void* data)
 {
-  (void)len;
-  if (data)
+  auto& counts = *(std::vector<PCRE2TraceCount>*)data;
+  if (block->pattern_position < counts.size())
   {
-    JanetPCRE2Regex* re = (JanetPCRE2Regex*)data;
-    if (re->re)
-    {
-      pcre2_code_free(re->re);
-      re->re = nullptr;
-    }
-    if (re->pattern)
-    {
-      delete (re->pattern);
-      re->pattern = nullptr;
-    }
-    if (re->flags)
-    {
-      re->flags->clear();
-      delete (re->flags);
-      re->flags = nullptr;
-    }
+    auto& count = counts[block->pattern_position];
+    ++count.visits;
+    if (block->callout_flags & PCRE2_CALLOUT_BACKTRACK)
+      ++count.backtracks;
+    count.item_length = (uint32_t)block->next_item_length;
   }
   return 0;
 }
 
-int
-pcre2_set_gcmark(void* data, size_t len)
+// Read the name table once, so matches can label groups without asking PCRE2.
+// Returns null for patterns without named groups.
+std::vector<std::string>*
+read_group_names(const pcre2_code* re)
 {
-  (void)len;
-  janet_mark(janet_wrap_abstract((JanetPCRE2Regex*)data));
-  return 0;
+  uint32_t   name_count = 0;
+  uint32_t   entry_size = 0;
+  uint32_t   captures   = 0;
+  PCRE2_SPTR table      = nullptr;
+  (void)pcre2_pattern_info(re, PCRE2_INFO_NAMECOUNT, &name_count);
+  if (name_count == 0)
+    return nullptr;
+  (void)pcre2_pattern_info(re, PCRE2_INFO_NAMEENTRYSIZE, &entry_size);
+  (void)pcre2_pattern_info(re, PCRE2_INFO_NAMETABLE, &table);
+  (void)pcre2_pattern_info(re, PCRE2_INFO_CAPTURECOUNT, &captures);
+
+  // each entry is a big-endian group number followed by the zero-terminated name
+  auto* names = new std::vector<std::string>(captures + 1);
+  for (uint32_t i = 0; i < name_count; ++i, table += entry_size)
+  {
+    uint32_t group = (table[0] << 8) | table[1];
+    names->at(group) = (const char*)(table + 2);
+  }
+  return names;
 }
 
-void
-pcre2_set_tostring(void* data, JanetBuffer* buffer)
+const PCRE2JitMode*
+get_pcre2_jit_mode(JanetKeyword kw)
 {
-  if (data)
+  for (auto&& mode : pcre2_jit_modes)
   {
-    JanetPCRE2Regex* re = (JanetPCRE2Regex*)data;
-    if (!re->pattern)
-    {
-      janet_buffer_push_cstring(buffer, "no pattern");
-      return;
-    }
-    janet_buffer_push_cstring(buffer, "pattern: '");
-    janet_buffer_push_cstring(buffer, re->pattern->c_str());
-    janet_buffer_push_cstring(buffer, "'");
-    if (!re->flags->empty())
-    {
-      janet_buffer_push_cstring(buffer, " flags: (");
-      bool first = true;
-      for (int32_t i = 0; i < re->flags->size(); ++i)
-      {
-        if (!first)
-          janet_buffer_push_cstring(buffer, " ");
-        janet_buffer_push_cstring(buffer, ":");
-        janet_buffer_push_cstring(buffer, re->flags->operator[](i).c_str());
-        first = false;
-      }
-      janet_buffer_push_cstring(buffer, ")");
-    }
-    else
-    {
-      janet_buffer_push_cstring(buffer, " flags: ()");
-    }
+    if (kw == janet_ckeyword(mode.name))
+      return &mode;
   }
+  return nullptr;
 }
 
-JanetAbstractType pcre2_regex_type = {};
-
-void initialize_pcre2_regex_type() {
-  if (!pcre2_regex_type.name) {
-    pcre2_regex_type.name = "pcre2";
-    pcre2_regex_type.gc = pcre2_set_gc;
-    pcre2_regex_type.gcmark = pcre2_set_gcmark;
-    pcre2_regex_type.tostring = pcre2_set_tostring;
+const PCRE2Flag*
+get_pcre2_flag_type(JanetKeyword kw)
+{
+  for (auto&& flag : pcre2_flags)
+  {
+    if (kw == janet_ckeyword(flag.name))
+      return &flag;
   }
+  return nullptr;
+}
 }
 
-JanetPCRE2Regex*
-new_abstract_pcre2_regex(const char* input, const Janet* argv, int32_t flag_start, int32_t argc)
+pcre2_general_context*
+pcre2_pool_context()
 {
-  initialize_pcre2_regex_type();
-  JanetPCRE2Regex* regex = (JanetPCRE2Regex*)janet_abstract(&pcre2_regex_type, sizeof(JanetPCRE2Regex));
+  // created once and never freed, like the pool
+  static pcre2_general_context* context = pcre2_general_context_create(pool_allocate, pool_release, &pcre2_pool());
+  return context;
+}
+
+namespace
+{
+// Set up regex, allocated as a regex_type abstract, from input and flags.
+// A code restored from a serialized regex is used rather than compiling
+// input, and is freed if the flags are bad.
+void
+init_pcre2_regex(JanetPCRE2Regex* regex, const char* input, const Janet* argv, int32_t flag_start, int32_t argc,
+                 pcre2_code* code)
+{
+  regex->engine          = &pcre2_engine;
   regex->re              = nullptr;
   regex->pattern         = nullptr;
   regex->flags           = new std::vector<std::string>();
   regex->jit             = false;
+  regex->jit_options     = PCRE2_JIT_COMPLETE;
+  regex->jit_error       = 0;
+  regex->dfa             = false;
+  regex->match_options   = 0;
+  regex->utf_check       = false;
+  regex->workspace       = nullptr;
+  regex->group_names     = nullptr;
+  regex->match_context   = nullptr;
+  regex->trace           = nullptr;
+  regex->prefilter       = nullptr;
+  regex->memory          = 0;
   uint32_t options       = 0;
+  bool     traced        = false;
 
   for (int32_t i = flag_start; i < argc; ++i)
   {
@@ -122,17 +189,45 @@ new_abstract_pcre2_regex(const char* input, const Janet* argv, int32_t flag_star
       break;
     }
     auto arg = janet_getkeyword(argv, i);
+    if (arg == janet_ckeyword(jit))
+    {
+      // :jit takes the next flag as its mode
+      const PCRE2JitMode* mode = nullptr;
+      if (i + 1 < argc && janet_checktype(argv[i + 1], JANET_KEYWORD))
+        mode = get_pcre2_jit_mode(janet_getkeyword(argv, i + 1));
+      if (!mode)
+      {
+        std::ostringstream os;
+        os << ":jit must be followed by a mode from " << jit_allowed;
+        regex->pattern = new std::string(os.str());
+        break;
+      }
+      regex->jit_options = mode->options;
+      regex->flags->push_back(jit);
+      regex->flags->push_back(mode->name);
+      ++i;
+      continue;
+    }
+    if (arg == janet_ckeyword(trace))
+    {
+      options |= PCRE2_AUTO_CALLOUT;
+      traced = true;
+      regex->flags->push_back(trace);
+      continue;
+    }
     if (arg)
     {
       auto ft = get_pcre2_flag_type(arg);
-      if (ft == 0)
+      if (!ft)
       {
         std::ostringstream os;
         os << ":" << arg << " is not a valid PCRE2 regex flag.\n  Flags should be from list " << pcre2_allowed;
         regex->pattern = new std::string(os.str());
         break;
       }
-      options |= ft;
+      options |= ft->compile_options;
+      regex->match_options |= ft->match_options;
+      regex->dfa = regex->dfa || ft->dfa;
       JanetBuffer temp;
       janet_buffer_init(&temp, 0);
       janet_buffer_push_string(&temp, arg);
@@ -148,12 +243,14 @@ new_abstract_pcre2_regex(const char* input, const Janet* argv, int32_t flag_star
   // if there is a pattern set, it is an error from above
   if (input && !regex->pattern)
   {
-    auto* re = pcre2_compile((PCRE2_SPTR)input,     /* the pattern */
-                             PCRE2_ZERO_TERMINATED, /* indicates pattern is zero-terminated */
-                             options,               /* default options */
-                             &errornumber,          /* for error number */
-                             &erroroffset,          /* for error offset */
-                             NULL);                 /* use default compile context */
+    auto* re = code ? code
+                    : pcre2_compile((PCRE2_SPTR)input,       /* the pattern */
+                                    PCRE2_ZERO_TERMINATED,   /* indicates pattern is zero-terminated */
+                                    options,                 /* default options */
+                                    &errornumber,            /* for error number */
+                                    &erroroffset,            /* for error offset */
+                                    pool_compile_context()); /* default compile context, pooled allocations */
+    code     = nullptr;
 
     if (re == NULL)
     {
@@ -167,138 +264,212 @@ new_abstract_pcre2_regex(const char* input, const Janet* argv, int32_t flag_star
     {
       regex->re      = re;
       regex->pattern = new std::string(input);
-      if (pcre2_jit_compile(regex->re, PCRE2_JIT_COMPLETE) >= 0)
-        regex->jit = true;
+      // without :no-utf-check, UTF subjects go through pcre2_match, which
+      // validates them, rather than the unchecked JIT fast path
+      regex->utf_check = (options & PCRE2_UTF) && !(regex->match_options & PCRE2_NO_UTF_CHECK);
+      regex->group_names = read_group_names(re);
+      // PCRE2 already rejects subjects that lack a byte every match needs,
+      // so the prefilter only pays when it can skip ahead, which an
+      // anchored match cannot
+      if ((options & PCRE2_CASELESS) && !(options & PCRE2_ANCHORED))
+        regex->prefilter = caseless_prefilter(input, options & PCRE2_UTF);
+      if (regex->prefilter && regex->prefilter->lead == SIZE_MAX)
+      {
+        delete regex->prefilter;
+        regex->prefilter = nullptr;
+      }
+      if (traced)
+      {
+        // one count per pattern offset, the last for the callout at the end
+        regex->trace         = new std::vector<PCRE2TraceCount>(strlen(input) + 1);
+        regex->match_context = pcre2_match_context_create(pcre2_pool_context());
+        pcre2_set_callout(regex->match_context, trace_callout, regex->trace);
+      }
+      if (regex->dfa)
+      {
+        regex->workspace = new std::vector<int>(dfa_workspace_initial);
+      }
+      else if (regex->jit_options && !traced)
+      {
+        // on failure the interpreter is used, the reason is kept for jre/info
+        regex->jit_error = pcre2_jit_compile(regex->re, regex->jit_options);
+        regex->jit       = regex->jit_error == 0;
+      }
     }
   }
+  if (code)
+    pcre2_code_free(code);
+}
+}
 
+JanetPCRE2Regex*
+new_abstract_pcre2_regex(const char* input, const Janet* argv, int32_t flag_start, int32_t argc)
+{
+  initialize_regex_type();
+  JanetPCRE2Regex* regex = (JanetPCRE2Regex*)janet_abstract(&regex_type, sizeof(JanetPCRE2Regex));
+  init_pcre2_regex(regex, input, argv, flag_start, argc, nullptr);
   return regex;
 }
 
-bool
-pcre2_contains(const JanetPCRE2Regex* regex, const char* subject, PCRE2_SIZE startIndex)
+JanetArray*
+pcre2_trace_profile(const JanetPCRE2Regex* regex, bool reset)
 {
-  auto options        = PCRE2_SUBSTITUTE_OVERFLOW_LENGTH;
-  auto match_data     = pcre2_match_data_create_from_pattern(regex->re, NULL);
-  auto subject_length = strlen(subject);
-  int  rc;
-  if (regex->jit)
+  JanetArray* profile = janet_array(0);
+  auto&       counts  = *regex->trace;
+  for (size_t offset = 0; offset < counts.size(); ++offset)
   {
-    rc = pcre2_jit_match(regex->re,           /* the compiled pattern */
-                         (PCRE2_SPTR)subject, /* the subject string */
-                         subject_length,      /* the length of the subject */
-                         startIndex,          /* start at offset in the subject */
-                         options,             /* default options */
-                         match_data,          /* block for storing the result */
-                         NULL);
+    auto& count = counts[offset];
+    if (!count.visits)
+      continue;
+    size_t   length = std::min<size_t>(count.item_length, regex->pattern->size() - offset);
+    JanetKV* entry  = janet_struct_begin(4);
+    janet_struct_put(entry, janet_ckeywordv("offset"), janet_wrap_number((double)offset));
+    janet_struct_put(entry, janet_ckeywordv("item"),
+                     janet_stringv((const uint8_t*)regex->pattern->data() + offset, (int32_t)length));
+    janet_struct_put(entry, janet_ckeywordv("visits"), janet_wrap_number((double)count.visits));
+    janet_struct_put(entry, janet_ckeywordv("backtracks"), janet_wrap_number((double)count.backtracks));
+    janet_array_push(profile, janet_wrap_struct(janet_struct_end(entry)));
+    if (reset)
+      count = PCRE2TraceCount();
   }
-  else
-  {
-    std::cerr << "non jit fallback" << std::endl;
-    rc = pcre2_match(regex->re,           /* the compiled pattern */
-                     (PCRE2_SPTR)subject, /* the subject string */
-                     subject_length,      /* the length of the subject */
-                     startIndex,          /* start at offset in the subject */
-                     options,             /* default options */
-                     match_data,          /* block for storing the result */
-                     NULL);
-  }
-
-  pcre2_match_data_free(match_data);
-  return rc > 0;
+  return profile;
 }
 
-std::vector<ReMatch>
-pcre2_match(const JanetPCRE2Regex* regex, const char* subject, PCRE2_SIZE startIndex, PCRE2_SIZE options,
-            bool firstOnly)
+int
+pcre2_exec(const JanetPCRE2Regex* regex, const char* subject, PCRE2_SIZE length, PCRE2_SIZE startIndex,
+           uint32_t options, pcre2_match_data* match_data)
 {
-  std::vector<ReMatch> matches;
-
-  auto match_data     = pcre2_match_data_create_from_pattern(regex->re, NULL);
-  auto subject_length = strlen(subject);
-  int  rc;
-  if (regex->jit)
+  if (regex->dfa)
   {
-    rc = pcre2_jit_match(regex->re,           /* the compiled pattern */
-                         (PCRE2_SPTR)subject, /* the subject string */
-                         subject_length,      /* the length of the subject */
-                         startIndex,          /* start at offset in the subject */
-                         options,             /* default options */
-                         match_data,          /* block for storing the result */
-                         NULL);
-  }
-  else
-  {
-    rc = pcre2_match(regex->re,           /* the compiled pattern */
-                     (PCRE2_SPTR)subject, /* the subject string */
-                     subject_length,      /* the length of the subject */
-                     startIndex,          /* start at offset in the subject */
-                     options,             /* default options */
-                     match_data,          /* block for storing the result */
-                     NULL);
-  }
-
-  // handle the case of failed match
-  // TODO - propagate error in janet_panic
-  if (rc <= 0)
-  {
-    pcre2_match_data_free(match_data);
-    return matches;
-  }
-
-  auto ovector = pcre2_get_ovector_pointer(match_data);
-
-  // first match is entire match, rest are capture groups
-  PCRE2_SPTR substring_start  = (PCRE2_SPTR)subject + ovector[0];
-  PCRE2_SIZE substring_length = ovector[1] - ovector[0];
-
-  ReMatch firstMatch;
-  firstMatch.begin = ovector[0];
-  firstMatch.end   = ovector[1];
-  firstMatch.val   = std::string((const char*)substring_start, substring_length);
-
-  if (rc > 1)
-  {
-    for (int i = 1; i < rc; i++)
+    auto& ws = *regex->workspace;
+    for (;;)
     {
-      PCRE2_SPTR substring_start  = (PCRE2_SPTR)subject + ovector[2 * i];
-      PCRE2_SIZE substring_length = ovector[2 * i + 1] - ovector[2 * i];
-      if (substring_length > 0)
+      int rc = pcre2_dfa_match(regex->re,                       /* the compiled pattern */
+                               (PCRE2_SPTR)subject,             /* the subject string */
+                               length,                          /* the length of the subject */
+                               startIndex,                      /* start at offset in the subject */
+                               options | regex->match_options,  /* includes longest or shortest */
+                               match_data,                      /* block for storing the result */
+                               regex->match_context,            /* the :trace callout, if any */
+                               ws.data(),                       /* workspace owned by regex */
+                               ws.size());                      /* size of workspace in ints */
+      if (rc == PCRE2_ERROR_DFA_WSSIZE && ws.size() < dfa_workspace_max)
       {
-        ReMatch group;
-        group.index = i;
-        group.begin = ovector[2 * i];
-        group.end   = ovector[2 * i + 1];
-        group.val   = std::string((const char*)substring_start, substring_length);
-        firstMatch.groups.emplace_back(group);
+        ws.resize(ws.size() * 2);
+        continue;
       }
+      // rc == 0 means more alternative matches than the ovector holds,
+      // but the first pair is still the longest (or shortest) match.
+      return rc >= 0 ? 1 : rc;
     }
   }
-  matches.emplace_back(firstMatch);
 
-  if (firstOnly)
+  options |= regex->match_options;
+
+  // JIT does not support PCRE2_ANCHORED at match time, partial matching
+  // needs its own compiled variant, and the fast path skips UTF validation
+  uint32_t variant = PCRE2_JIT_COMPLETE;
+  if (options & PCRE2_PARTIAL_HARD)
+    variant = PCRE2_JIT_PARTIAL_HARD;
+  else if (options & PCRE2_PARTIAL_SOFT)
+    variant = PCRE2_JIT_PARTIAL_SOFT;
+
+  if (regex->jit && (regex->jit_options & variant) && !(options & PCRE2_ANCHORED)
+      && !(regex->utf_check && !(options & PCRE2_NO_UTF_CHECK)))
   {
-    pcre2_match_data_free(match_data);
-    return matches;
+    return pcre2_jit_match(regex->re,           /* the compiled pattern */
+                           (PCRE2_SPTR)subject, /* the subject string */
+                           length,              /* the length of the subject */
+                           startIndex,          /* start at offset in the subject */
+                           options,             /* match options */
+                           match_data,          /* block for storing the result */
+                           regex->match_context);
   }
 
+  return pcre2_match(regex->re,           /* the compiled pattern */
+                     (PCRE2_SPTR)subject, /* the subject string */
+                     length,              /* the length of the subject */
+                     startIndex,          /* start at offset in the subject */
+                     options,             /* match options */
+                     match_data,          /* block for storing the result */
+                     regex->match_context);
+}
+
+PCRE2MatchIterator::PCRE2MatchIterator(const JanetPCRE2Regex* regex, uint32_t options)
+    : m_regex(regex), m_base_options(options)
+{
+  m_match_data = pcre2_match_data_create_from_pattern(regex->re, pcre2_pool_context());
+  m_ovector    = pcre2_get_ovector_pointer(m_match_data);
+
   /* Before running the loop, check for UTF-8 and whether CRLF is a valid newline
      sequence. First, find the options with which the regex was compiled and extract
      the UTF state. */
 
   uint32_t option_bits;
   (void)pcre2_pattern_info(regex->re, PCRE2_INFO_ALLOPTIONS, &option_bits);
-  int utf8 = (option_bits & PCRE2_UTF) != 0;
+  m_utf8 = (option_bits & PCRE2_UTF) != 0;
 
   /* Now find the newline convention and see whether CRLF is a valid newline
   sequence. */
 
   uint32_t newline;
   (void)pcre2_pattern_info(regex->re, PCRE2_INFO_NEWLINE, &newline);
-  int crlf_is_newline
-      = newline == PCRE2_NEWLINE_ANY || newline == PCRE2_NEWLINE_CRLF || newline == PCRE2_NEWLINE_ANYCRLF;
+  m_crlf = newline == PCRE2_NEWLINE_ANY || newline == PCRE2_NEWLINE_CRLF || newline == PCRE2_NEWLINE_ANYCRLF;
+}
 
-  // now loop over any subsequent matches
+PCRE2MatchIterator::~PCRE2MatchIterator()
+{
+  pcre2_match_data_free(m_match_data);
+}
+
+void
+PCRE2MatchIterator::reset(const char* subject, size_t length, size_t start)
+{
+  m_subject = subject;
+  m_length  = length;
+  m_start   = start;
+  m_options = 0;
+  m_rc      = 0;
+  m_error   = 0;
+  m_first   = true;
+  m_done    = start > length; // past the end, there is nothing to find
+}
+
+std::string
+PCRE2MatchIterator::error() const
+{
+  if (!m_error)
+    return "";
+  PCRE2_UCHAR buffer[256];
+  pcre2_get_error_message(m_error, buffer, sizeof(buffer));
+  return (const char*)buffer;
+}
+
+bool
+PCRE2MatchIterator::next()
+{
+  if (m_done)
+    return false;
+
+  if (m_first)
+  {
+    m_first = false;
+    m_rc    = pcre2_exec(m_regex, m_subject, m_length, m_start, m_base_options, m_match_data);
+    // handle the case of failed match
+    if (m_rc <= 0)
+    {
+      if (m_rc != PCRE2_ERROR_NOMATCH)
+        m_error = m_rc;
+      m_done = true;
+      return false;
+    }
+    // the subject has been validated once, there is no need to check
+    // the whole string again on every following match
+    m_options = PCRE2_NO_UTF_CHECK;
+    return true;
+  }
+
+  PCRE2_SIZE* ovector = m_ovector;
   for (;;)
   {
     uint32_t   options      = 0;          /* Normally no options */
@@ -310,49 +481,31 @@ pcre2_match(const JanetPCRE2Regex* regex, const char* subject, PCRE2_SIZE startI
 
     if (ovector[0] == ovector[1])
     {
-      if (ovector[0] == subject_length)
+      if (ovector[0] == m_length)
         break;
       options = PCRE2_NOTEMPTY_ATSTART | PCRE2_ANCHORED;
     }
     else
     {
-      PCRE2_SIZE startchar = pcre2_get_startchar(match_data);
+      PCRE2_SIZE startchar = pcre2_get_startchar(m_match_data);
       if (start_offset <= startchar)
       {
-        if (startchar >= subject_length)
+        if (startchar >= m_length)
           break; /* Reached end of subject.   */
 
         start_offset = startchar + 1; /* Advance by one character. */
-        if (utf8)                     /* If UTF-8, it may be more  */
+        if (m_utf8)                   /* If UTF-8, it may be more  */
         {                             /*   than one code unit.     */
-          for (; start_offset < subject_length; start_offset++)
-            if ((subject[start_offset] & 0xc0) != 0x80)
+          for (; start_offset < m_length; start_offset++)
+            if ((m_subject[start_offset] & 0xc0) != 0x80)
               break;
         }
       }
     }
 
     /* Run the next matching operation */
-    if (regex->jit)
-    {
-      rc = pcre2_jit_match(regex->re,           /* the compiled pattern */
-                           (PCRE2_SPTR)subject, /* the subject string */
-                           subject_length,      /* the length of the subject */
-                           start_offset,        /* start at offset in the subject */
-                           options,             /* default options */
-                           match_data,          /* block for storing the result */
-                           NULL);
-    }
-    else
-    {
-      rc = pcre2_match(regex->re,           /* the compiled pattern */
-                       (PCRE2_SPTR)subject, /* the subject string */
-                       subject_length,      /* the length of the subject */
-                       start_offset,        /* start at offset in the subject */
-                       options,             /* default options */
-                       match_data,          /* block for storing the result */
-                       NULL);
-    }
+    m_rc = pcre2_exec(m_regex, m_subject, m_length, start_offset, options | m_options | m_base_options,
+                      m_match_data);
 
     /* This time, a result of NOMATCH isn't an error. If the value in "options"
 is zero, it just means we have found all possible matches, so the loop ends.
@@ -367,20 +520,20 @@ the current position is just before it, advance by an extra byte. (b)
 Otherwise we must ensure that we skip an entire UTF character if we are in
 UTF mode. */
 
-    if (rc == PCRE2_ERROR_NOMATCH)
+    if (m_rc == PCRE2_ERROR_NOMATCH)
     {
       if (options == 0)
-        break;                                 /* All matches found */
-      ovector[1] = start_offset + 1;           /* Advance one code unit */
-      if (crlf_is_newline &&                   /* If CRLF is a newline & */
-          start_offset < subject_length - 1 && /* we are at CRLF, */
-          subject[start_offset] == '\r' && subject[start_offset + 1] == '\n')
-        ovector[1] += 1;                    /* Advance by one more. */
-      else if (utf8)                        /* Otherwise, ensure we */
-      {                                     /* advance a whole UTF-8 */
-        while (ovector[1] < subject_length) /* character. */
+        break;                               /* All matches found */
+      ovector[1] = start_offset + 1;         /* Advance one code unit */
+      if (m_crlf &&                          /* If CRLF is a newline & */
+          start_offset < m_length - 1 &&     /* we are at CRLF, */
+          m_subject[start_offset] == '\r' && m_subject[start_offset + 1] == '\n')
+        ovector[1] += 1;                     /* Advance by one more. */
+      else if (m_utf8)                       /* Otherwise, ensure we */
+      {                                      /* advance a whole UTF-8 */
+        while (ovector[1] < m_length)        /* character. */
         {
-          if ((subject[ovector[1]] & 0xc0) != 0x80)
+          if ((m_subject[ovector[1]] & 0xc0) != 0x80)
             break;
           ovector[1] += 1;
         }
@@ -389,45 +542,242 @@ UTF mode. */
     }
 
     /* Other matching errors are not recoverable. */
-    // TODO - propagate error in janet_panic
-    if (rc < 0)
+    if (m_rc < 0)
     {
-      pcre2_match_data_free(match_data);
-      // zero out any temp results
-      matches.clear();
-      return matches;
+      m_error = m_rc;
+      break;
     }
+    return true;
+  }
 
-    // first match is entire match, rest are capture groups
-    // JanetTable* matchResults     = janet_table(3);
-    PCRE2_SPTR substring_start  = (PCRE2_SPTR)subject + ovector[0];
-    PCRE2_SIZE substring_length = ovector[1] - ovector[0];
+  m_done = true;
+  return false;
+}
 
-    ReMatch nextMatch;
-    nextMatch.begin = ovector[0];
-    nextMatch.end   = ovector[1];
-    nextMatch.val   = std::string((const char*)substring_start, substring_length);
 
-    if (rc > 1)
+namespace
+{
+JanetRegex*
+pcre2_engine_compile(const char* pattern, const Janet* argv, int32_t flag_start, int32_t argc, std::string& error)
+{
+  JanetPCRE2Regex* regex = new_abstract_pcre2_regex(pattern, argv, flag_start, argc);
+  return regex_compiled(regex, regex->re != nullptr, error);
+}
+
+void
+pcre2_engine_release(JanetRegex* base)
+{
+  JanetPCRE2Regex* re = static_cast<JanetPCRE2Regex*>(base);
+  if (re->re)
+  {
+    pcre2_code_free(re->re);
+    re->re = nullptr;
+  }
+  if (re->workspace)
+  {
+    delete (re->workspace);
+    re->workspace = nullptr;
+  }
+  if (re->group_names)
+  {
+    delete (re->group_names);
+    re->group_names = nullptr;
+  }
+  if (re->match_context)
+  {
+    pcre2_match_context_free(re->match_context);
+    re->match_context = nullptr;
+  }
+  if (re->trace)
+  {
+    delete (re->trace);
+    re->trace = nullptr;
+  }
+}
+
+int
+pcre2_engine_captures(const JanetRegex* base)
+{
+  uint32_t capture_count = 0;
+  (void)pcre2_pattern_info(static_cast<const JanetPCRE2Regex*>(base)->re, PCRE2_INFO_CAPTURECOUNT, &capture_count);
+  return (int)capture_count;
+}
+
+void
+pcre2_engine_info(const JanetRegex* base, JanetTable* info)
+{
+  const JanetPCRE2Regex* regex = static_cast<const JanetPCRE2Regex*>(base);
+  janet_table_put(info, janet_ckeywordv("dfa"), janet_wrap_boolean(regex->dfa));
+  janet_table_put(info, janet_ckeywordv("jit"), janet_wrap_boolean(regex->jit));
+  janet_table_put(info, janet_ckeywordv("trace"), janet_wrap_boolean(regex->trace != nullptr));
+  for (auto&& mode : pcre2_jit_modes)
+  {
+    if (mode.options == regex->jit_options)
+      janet_table_put(info, janet_ckeywordv("jit-mode"), janet_ckeywordv(mode.name));
+  }
+  if (regex->jit_error)
+  {
+    PCRE2_UCHAR buffer[256];
+    pcre2_get_error_message(regex->jit_error, buffer, sizeof(buffer));
+    janet_table_put(info, janet_ckeywordv("jit-error"), janet_cstringv((const char*)buffer));
+  }
+
+  if (regex->group_names)
+  {
+    // duplicate names (?J) map to their first group
+    JanetTable* names = janet_table(0);
+    for (size_t i = regex->group_names->size(); i-- > 1;)
     {
-      for (int i = 1; i < rc; i++)
-      {
-        PCRE2_SPTR substring_start  = (PCRE2_SPTR)subject + ovector[2 * i];
-        PCRE2_SIZE substring_length = ovector[2 * i + 1] - ovector[2 * i];
-        if (substring_length > 0)
-        {
-          ReMatch group;
-          group.index = i;
-          group.begin = ovector[2 * i];
-          group.end   = ovector[2 * i + 1];
-          group.val   = std::string((const char*)substring_start, substring_length);
-          nextMatch.groups.emplace_back(group);
-        }
-      }
+      auto& name = regex->group_names->at(i);
+      if (!name.empty())
+        janet_table_put(names, janet_ckeywordv(name.c_str()), janet_wrap_integer((int32_t)i));
+    }
+    janet_table_put(info, janet_ckeywordv("names"), janet_wrap_table(names));
+  }
+}
+
+RegexMatcherPtr
+pcre2_engine_matcher(const JanetRegex* base, bool any)
+{
+  const JanetPCRE2Regex* regex = static_cast<const JanetPCRE2Regex*>(base);
+  // existence only, so the DFA matcher can stop at the shortest match
+  return RegexMatcherPtr(new PCRE2MatchIterator(regex, any && regex->dfa ? PCRE2_DFA_SHORTEST : 0));
+}
+
+bool
+pcre2_engine_substitute(const JanetRegex* base, const char* subject, size_t length, const char* subst, bool all,
+                        JanetBuffer* out, std::string& error)
+{
+  const JanetPCRE2Regex* regex = static_cast<const JanetPCRE2Regex*>(base);
+
+  // of the per-regex match options, only the UTF check applies to substitution
+  uint32_t options = PCRE2_SUBSTITUTE_OVERFLOW_LENGTH | (regex->match_options & PCRE2_NO_UTF_CHECK);
+  if (all)
+    options |= PCRE2_SUBSTITUTE_GLOBAL;
+
+  // write straight into out, guessing the result is about the size of the
+  // subject; if not, PCRE2 reports the size it needs and we go again once
+  PCRE2_SIZE size = length + strlen(subst) + 1;
+  for (;;)
+  {
+    janet_buffer_extra(out, (int32_t)size);
+    PCRE2_SIZE outlen = size;
+    int        rc     = pcre2_substitute(regex->re,
+                                         (PCRE2_SPTR)subject,    // input string to replace into
+                                         length,                 // length of input string
+                                         0,                      // offset
+                                         options,                // options
+                                         NULL,                   // match_data
+                                         regex->match_context,   // mcontext
+                                         (PCRE2_SPTR)subst,      // string to replace matches with
+                                         PCRE2_ZERO_TERMINATED,  // length of replacement string
+                                         out->data + out->count, // output buffer
+                                         &outlen);
+    if (rc == PCRE2_ERROR_NOMEMORY && outlen > size)
+    {
+      size = outlen;
+      continue;
     }
-    matches.emplace_back(nextMatch);
+    if (rc < 0)
+    {
+      PCRE2_UCHAR buffer[256];
+      pcre2_get_error_message(rc, buffer, sizeof(buffer));
+      error = (const char*)buffer;
+      return false;
+    }
+    out->count += (int32_t)outlen;
+    return true;
   }
+}
 
-  pcre2_match_data_free(match_data);
-  return matches;
+const std::string*
+pcre2_engine_group_name(const JanetRegex* base, int group)
+{
+  const JanetPCRE2Regex* regex = static_cast<const JanetPCRE2Regex*>(base);
+  if (!regex->group_names || group >= (int)regex->group_names->size() || regex->group_names->at(group).empty())
+    return nullptr;
+  return &regex->group_names->at(group);
+}
+
+bool
+pcre2_engine_restore(JanetRegex* base, const char* pattern, const Janet* argv, int32_t argc,
+                     const std::string& serialized)
+{
+  // a regex serialized by another PCRE2 build fails to decode and is
+  // compiled from its pattern instead
+  pcre2_code* code = nullptr;
+  if (!serialized.empty() && pcre2_serialize_decode(&code, 1, (const uint8_t*)serialized.data(), pcre2_pool_context()) != 1)
+    code = nullptr;
+  JanetPCRE2Regex* regex = static_cast<JanetPCRE2Regex*>(base);
+  init_pcre2_regex(regex, pattern, argv, 0, argc, code);
+  return regex->re != nullptr;
 }
+
+std::string
+pcre2_engine_serialize(const JanetRegex* base)
+{
+  const JanetPCRE2Regex* re    = static_cast<const JanetPCRE2Regex*>(base);
+  const pcre2_code*      codes = re->re;
+  uint8_t*               bytes = nullptr;
+  PCRE2_SIZE             size  = 0;
+  if (pcre2_serialize_encode(&codes, 1, &bytes, &size, pcre2_pool_context()) != 1)
+    return std::string();
+  std::string serialized((const char*)bytes, size);
+  pcre2_serialize_free(bytes);
+  return serialized;
+}
+
+// PCRE2 counts characters, which take up to four bytes with :utf, and
+// leaves out ^ with :multiline, which looks at the one before
+size_t
+pcre2_engine_lookbehind(const JanetRegex* base)
+{
+  const JanetPCRE2Regex* regex      = static_cast<const JanetPCRE2Regex*>(base);
+  uint32_t               characters = 0;
+  uint32_t               options    = 0;
+  if (pcre2_pattern_info(regex->re, PCRE2_INFO_MAXLOOKBEHIND, &characters) != 0)
+    return SIZE_MAX;
+  (void)pcre2_pattern_info(regex->re, PCRE2_INFO_ALLOPTIONS, &options);
+  characters = std::max(characters, 1u);
+  return (options & PCRE2_UTF) ? 4 * (size_t)characters : characters;
+}
+
+// the compiled and JIT code as PCRE2 sizes them, and the buffers kept for
+// :dfa, :trace and group names
+size_t
+pcre2_engine_memory(const JanetRegex* base)
+{
+  const JanetPCRE2Regex* regex = static_cast<const JanetPCRE2Regex*>(base);
+  size_t                 code  = 0;
+  size_t                 jit   = 0;
+  (void)pcre2_pattern_info(regex->re, PCRE2_INFO_SIZE, &code);
+  (void)pcre2_pattern_info(regex->re, PCRE2_INFO_JITSIZE, &jit);
+  size_t bytes = code + jit;
+  if (regex->workspace)
+    bytes += regex->workspace->capacity() * sizeof(int);
+  if (regex->trace)
+    bytes += regex->trace->capacity() * sizeof(PCRE2TraceCount);
+  if (regex->group_names)
+  {
+    for (auto&& name : *regex->group_names)
+      bytes += sizeof(std::string) + name.capacity();
+  }
+  return bytes;
+}
+}
+
+const RegexEngine pcre2_engine = {
+  "pcre2",
+  pcre2_engine_compile,
+  pcre2_engine_release,
+  pcre2_engine_captures,
+  pcre2_engine_info,
+  pcre2_engine_matcher,
+  pcre2_engine_substitute,
+  pcre2_engine_group_name,
+  sizeof(JanetPCRE2Regex),
+  pcre2_engine_restore,
+  pcre2_engine_serialize,
+  pcre2_engine_lookbehind,
+  pcre2_engine_memory,
+};
@@ -9,25 +9,86 @@
 #include <string>
 #include <vector>
 
-#include "results.h"
+#include "regex.h"
 
-struct JanetPCRE2Regex
+// What the :trace callout saw at one pattern offset.
+struct PCRE2TraceCount
 {
-  JanetGCObject             gc;
-  pcre2_code*               re      = nullptr;
-  std::string*              pattern = nullptr;
-  std::vector<std::string>* flags   = nullptr;
-  bool                      jit     = false;
+  uint64_t visits      = 0; // times matching reached the item here
+  uint64_t backtracks  = 0; // of those, how many resumed here after a backtrack
+  uint32_t item_length = 0; // length of the pattern item at this offset
 };
 
-extern JanetAbstractType pcre2_regex_type;
+// A regex compiled by PCRE2, JIT compiled unless :jit :off or :trace.
+struct JanetPCRE2Regex : JanetRegex
+{
+  pcre2_code*                   re            = nullptr;
+  bool                          jit           = false;
+  uint32_t                      jit_options   = PCRE2_JIT_COMPLETE;
+  int                           jit_error     = 0;
+  bool                          dfa           = false;
+  bool                          utf_check     = false;
+  uint32_t                      match_options = 0;
+  std::vector<int>*             workspace     = nullptr;
+  std::vector<std::string>*     group_names   = nullptr; // by group number, empty for unnamed groups
+  pcre2_match_context*          match_context = nullptr; // installs the :trace callout, null otherwise
+  std::vector<PCRE2TraceCount>* trace         = nullptr; // by pattern offset, with :trace
+};
+
+extern const RegexEngine pcre2_engine;
 
+// Routes PCRE2's allocations through pcre2_pool(). Pass it wherever PCRE2
+// takes a general context; compiled code, and the match data created from
+// it, allocate through it as well.
+pcre2_general_context* pcre2_pool_context();
+
+// On failure `re` is null and `pattern` holds the error message.
 JanetPCRE2Regex* new_abstract_pcre2_regex(const char* input, const Janet* argv, int32_t flag_start, int32_t argc);
 
-int  pcre2_set_gc(void* data, size_t len);
-int  pcre2_set_gcmark(void* data, size_t len);
-void pcre2_set_tostring(void* data, JanetBuffer* buffer);
+// Array of {:offset :item :visits :backtracks} for every pattern item a
+// :trace regex has reached, in pattern order. Reset clears the counts.
+JanetArray* pcre2_trace_profile(const JanetPCRE2Regex* regex, bool reset);
+
+// Run a single match at startIndex, dispatching to JIT, interpreter or DFA matcher.
+// For DFA regexes a non-negative result is normalised to 1, since only the
+// longest (or shortest) whole match is reported and there are no captures.
+int pcre2_exec(const JanetPCRE2Regex* regex, const char* subject, PCRE2_SIZE length, PCRE2_SIZE startIndex,
+               uint32_t options, pcre2_match_data* match_data);
 
-std::vector<ReMatch> pcre2_match(const JanetPCRE2Regex* regex, const char* subject, PCRE2_SIZE startIndex,
-                                 PCRE2_SIZE options, bool firstOnly = false);
-bool                 pcre2_contains(const JanetPCRE2Regex* regex, const char* subject, PCRE2_SIZE startIndex = 0);
+// Walks successive non-overlapping matches, handling empty matches, CRLF and
+// UTF-8 the same way pcre2demo does.  One match data block is used for every
+// walk, and `options` are added to every match call.
+class PCRE2MatchIterator : public RegexMatcher
+{
+public:
+  explicit PCRE2MatchIterator(const JanetPCRE2Regex* regex, uint32_t options = 0);
+  ~PCRE2MatchIterator() override;
+
+  PCRE2MatchIterator(const PCRE2MatchIterator&)            = delete;
+  PCRE2MatchIterator& operator=(const PCRE2MatchIterator&) = delete;
+
+  void          reset(const char* subject, size_t length, size_t start) override;
+  bool          next() override;
+  const size_t* spans() const override { return m_ovector; }
+  int           count() const override { return m_rc; }
+  std::string   error() const override;
+
+  // The name of the last (*MARK) passed on the way to the current match, or null.
+  const char* mark() const { return (const char*)pcre2_get_mark(m_match_data); }
+
+private:
+  const JanetPCRE2Regex* m_regex;
+  const char*            m_subject = nullptr;
+  PCRE2_SIZE             m_length  = 0;
+  PCRE2_SIZE             m_start   = 0;
+  pcre2_match_data*      m_match_data;
+  PCRE2_SIZE*            m_ovector;
+  uint32_t               m_base_options;
+  uint32_t               m_options = 0;
+  int                    m_rc      = 0;
+  int                    m_error   = 0;
+  bool                   m_first   = true;
+  bool                   m_done    = false;
+  bool                   m_utf8    = false;
+  bool                   m_crlf    = false;
+};
@@ -1,7 +1,8 @@
 #include "wrap_std_regex.h"
-#include "results.h"
 
+#include <cstring>
 #include <iostream>
+#include <iterator>
 #include <sstream>
 
 namespace
@@ -55,101 +56,38 @@ get_std_flag_type(JanetKeyword kw)
 }
 } // empty namespace
 
-int
-set_gc(void* data, size_t len)
-{
-  (void)len;
-  if (data)
-  {
-    JanetRegex* re = (JanetRegex*)data;
-    if (re->re)
-    {
-      delete (re->re);
-      re->re = nullptr;
-    }
-    if (re->pattern)
-    {
-      delete (re->pattern);
-      re->pattern = nullptr;
-    }
-    if (re->flags)
-    {
-      re->flags->clear();
-      delete (re->flags);
-      re->flags = nullptr;
-    }
-  }
-  return 0;
-}
+const char* std_regex_allowed = "[:ignorecase :optimize :collate :ecmascript :basic "
+                                ":extended :awk :grep :egrep]";
 
-int
-set_gcmark(void* data, size_t len)
+namespace
 {
-  (void)len;
-  janet_mark(janet_wrap_abstract((JanetRegex*)data));
-  return 0;
-}
-
-void
-set_tostring(void* data, JanetBuffer* buffer)
+// caseless_prefilter reads ECMAScript syntax, which ERE shares for what it
+// looks at. BRE escapes its intervals and groups, so `ab\{2\}` would be
+// taken to need a literal brace, and grep and egrep treat a newline as |.
+bool
+prefilter_reads(std::regex::flag_type flags, const char* input)
 {
-  if (data)
-  {
-    JanetRegex* re = (JanetRegex*)data;
-    if (!re->pattern)
-    {
-      janet_buffer_push_cstring(buffer, "no pattern");
-      return;
-    }
-    janet_buffer_push_cstring(buffer, "pattern: '");
-    janet_buffer_push_cstring(buffer, re->pattern->c_str());
-    janet_buffer_push_cstring(buffer, "'");
-    if (!re->flags->empty())
-    {
-      janet_buffer_push_cstring(buffer, " flags: (");
-      bool first = true;
-      for (int32_t i = 0; i < re->flags->size(); ++i)
-      {
-        if (!first)
-          janet_buffer_push_cstring(buffer, " ");
-        janet_buffer_push_cstring(buffer, ":");
-        janet_buffer_push_cstring(buffer, re->flags->operator[](i).c_str());
-        first = false;
-      }
-      janet_buffer_push_cstring(buffer, ")");
-    }
-    else
-    {
-      janet_buffer_push_cstring(buffer, " flags: ()");
-    }
-  }
+  auto grammar = flags & (std::regex::ECMAScript | std::regex::basic | std::regex::extended | std::regex::awk |
+                          std::regex::grep | std::regex::egrep);
+  if (grammar == std::regex::egrep)
+    return strchr(input, '\n') == nullptr;
+  return !grammar || grammar == std::regex::ECMAScript || grammar == std::regex::extended;
 }
 
-JanetAbstractType regex_type = {};
-
-void initialize_regex_type() {
-  if (!regex_type.name) {
-    regex_type.name = "jre";
-    regex_type.gc = set_gc;
-    regex_type.gcmark = set_gcmark;
-    regex_type.tostring = set_tostring;
-  }
-}
-
-
-const char* std_regex_allowed = "[:ignorecase :optimize :collate :ecmascript :basic "
-                                ":extended :awk :grep :egrep]";
-
-JanetRegex*
-new_abstract_regex(const char* input, const Janet* argv, int32_t flag_start, int32_t argc)
+// Set up regex, allocated as a regex_type abstract, from input and flags.
+void
+init_std_regex(JanetStdRegex* regex, const char* input, const Janet* argv, int32_t flag_start, int32_t argc)
 {
-  initialize_regex_type();
-  std::regex::flag_type flags = std::regex::ECMAScript;
+  // no grammar means ECMAScript, and setting it here would conflict with
+  // :basic and the others
+  std::regex::flag_type flags = std::regex::flag_type();
 
-  JanetRegex* regex = (JanetRegex*)janet_abstract(&regex_type, sizeof(JanetRegex));
-  regex->re         = nullptr;
-  regex->pattern    = nullptr;
-  regex->flags      = new std::vector<std::string>();
+  regex->engine        = &std_engine;
+  regex->re            = nullptr;
+  regex->pattern       = nullptr;
+  regex->flags         = new std::vector<std::string>();
+  regex->prefilter     = nullptr;
+  regex->memory        = 0;
 
   for (int32_t i = flag_start; i < argc; ++i)
   {
@@ -198,6 +136,8 @@ new_abstract_regex(const char* input, const Janet* argv, int32_t flag_start, int
       }
       regex->re      = re;
       regex->pattern = new std::string(input);
+      if ((flags & std::regex::icase) && prefilter_reads(flags, input))
+        regex->prefilter = caseless_prefilter(input, false);
     }
     catch (const std::regex_error& e)
     {
@@ -206,57 +146,211 @@ new_abstract_regex(const char* input, const Janet* argv, int32_t flag_start, int
       regex->pattern = new std::string(os.str());
     }
   }
+}
+}
+
+JanetStdRegex*
+new_abstract_std_regex(const char* input, const Janet* argv, int32_t flag_start, int32_t argc)
+{
+  initialize_regex_type();
+  JanetStdRegex* regex = (JanetStdRegex*)janet_abstract(&regex_type, sizeof(JanetStdRegex));
+  init_std_regex(regex, input, argv, flag_start, argc);
   return regex;
 }
 
-JanetTable*
-extract_table_from_match(const std::string& input, const std::smatch& match)
+
+namespace
+{
+// Walks matches with std::cregex_iterator over the caller's bytes. When the
+// walk starts part way into the subject, the text before it is still seen
+// by ^ and \b (match_prev_avail). std::regex reports running out of
+// resources by throwing, which ends the walk with the message in error().
+class StdRegexMatcher : public RegexMatcher
 {
-  JanetTable* results = janet_table(5);
+public:
+  explicit StdRegexMatcher(const std::regex& re) : m_re(re) {}
 
-  janet_table_put(results, janet_ckeywordv("begin"), janet_wrap_integer(match.position()));
-  janet_table_put(results, janet_ckeywordv("end"), janet_wrap_integer(match.position() + match.length()));
-  auto&& sub = match[0];
-  auto   bgn = std::distance(input.begin(), sub.first);
-  auto   end = bgn + sub.length();
-  janet_table_put(results, janet_ckeywordv("val"),
-                  janet_wrap_string(janet_string((const uint8_t*)sub.str().data(), sub.str().size())));
+  void
+  reset(const char* subject, size_t length, size_t start) override
+  {
+    m_subject = subject;
+    m_length  = length;
+    m_start   = start;
+    m_iter    = std::cregex_iterator();
+    m_first   = true;
+    m_error.clear();
+  }
 
-  if (match.size() > 1)
+  bool
+  next() override
   {
-    JanetArray* groups = janet_array(0);
-    for (size_t j = 1; j < match.size(); ++j)
+    try
     {
-      if (match[j].matched)
+      if (m_first)
       {
-        JanetTable* group = janet_table(4);
-        auto&&      sub   = match[j];
-        auto        bgn   = std::distance(input.begin(), sub.first);
-        auto        end   = bgn + sub.length();
+        m_first = false;
+        if (m_start > m_length)
+          return false;
+        auto flags = m_start > 0 ? std::regex_constants::match_prev_avail : std::regex_constants::match_default;
+        m_iter     = std::cregex_iterator(m_subject + m_start, m_subject + m_length, m_re, flags);
+      }
+      else if (m_iter != std::cregex_iterator())
+      {
+        ++m_iter;
+      }
+    }
+    catch (const std::regex_error& e)
+    {
+      m_error = e.what();
+      m_iter  = std::cregex_iterator();
+    }
+    if (m_iter == std::cregex_iterator())
+      return false;
 
-        janet_table_put(group, janet_ckeywordv("group-index"), janet_wrap_integer(j));
-        janet_table_put(group, janet_ckeywordv("val"),
-                        janet_wrap_string(janet_string((const uint8_t*)sub.str().data(), sub.str().size())));
-        Janet matched = sub.matched ? janet_wrap_true() : janet_wrap_false();
-        janet_table_put(group, janet_ckeywordv("begin"), janet_wrap_integer(bgn));
-        janet_table_put(group, janet_ckeywordv("end"), janet_wrap_integer(end));
-        janet_array_push(groups, janet_wrap_table(group));
+    auto&& match = *m_iter;
+    m_spans.clear();
+    for (size_t j = 0; j < match.size(); ++j)
+    {
+      if (match[j].matched)
+      {
+        size_t begin = match[j].first - m_subject;
+        m_spans.push_back(begin);
+        m_spans.push_back(begin + match[j].length());
+      }
+      else
+      {
+        m_spans.push_back(SIZE_MAX);
+        m_spans.push_back(SIZE_MAX);
       }
-      janet_table_put(results, janet_ckeywordv("groups"), janet_wrap_array(groups));
     }
+    return true;
   }
-  return results;
+
+  const size_t*
+  spans() const override
+  {
+    return m_spans.data();
+  }
+
+  int
+  count() const override
+  {
+    return (int)(m_spans.size() / 2);
+  }
+
+  std::string
+  error() const override
+  {
+    return m_error;
+  }
+
+private:
+  const std::regex&    m_re;
+  std::cregex_iterator m_iter;
+  std::vector<size_t>  m_spans;
+  std::string          m_error;
+  const char*          m_subject = nullptr;
+  size_t               m_length  = 0;
+  size_t               m_start   = 0;
+  bool                 m_first   = true;
+};
+
+JanetRegex*
+std_engine_compile(const char* pattern, const Janet* argv, int32_t flag_start, int32_t argc, std::string& error)
+{
+  JanetStdRegex* regex = new_abstract_std_regex(pattern, argv, flag_start, argc);
+  return regex_compiled(regex, regex->re != nullptr, error);
 }
 
-JanetArray*
-extract_array_from_iterator(const std::string& input, std::sregex_iterator& iter)
+void
+std_engine_release(JanetRegex* base)
 {
-  JanetArray* results   = janet_array(0);
-  auto        searchEnd = std::sregex_iterator();
-  while (iter != searchEnd)
+  JanetStdRegex* re = static_cast<JanetStdRegex*>(base);
+  if (re->re)
   {
-    janet_array_push(results, janet_wrap_table(extract_table_from_match(input, *iter)));
-    ++iter;
+    delete (re->re);
+    re->re = nullptr;
   }
-  return results;
 }
+
+int
+std_engine_captures(const JanetRegex* base)
+{
+  return (int)static_cast<const JanetStdRegex*>(base)->re->mark_count();
+}
+
+void
+std_engine_info(const JanetRegex* base, JanetTable* info)
+{
+  (void)base;
+  (void)info;
+}
+
+RegexMatcherPtr
+std_engine_matcher(const JanetRegex* base, bool any)
+{
+  (void)any;
+  return RegexMatcherPtr(new StdRegexMatcher(*static_cast<const JanetStdRegex*>(base)->re));
+}
+
+bool
+std_engine_substitute(const JanetRegex* base, const char* subject, size_t length, const char* subst, bool all,
+                      JanetBuffer* out, std::string& error)
+{
+  const JanetStdRegex* regex = static_cast<const JanetStdRegex*>(base);
+  auto flags = all ? std::regex_constants::format_default : std::regex_constants::format_first_only;
+  try
+  {
+    std::string result;
+    std::regex_replace(std::back_inserter(result), subject, subject + length, *regex->re, subst, flags);
+    janet_buffer_push_bytes(out, (const uint8_t*)result.data(), (int32_t)result.size());
+    return true;
+  }
+  catch (const std::regex_error& e)
+  {
+    error = e.what();
+    return false;
+  }
+}
+
+bool
+std_engine_restore(JanetRegex* base, const char* pattern, const Janet* argv, int32_t argc, const std::string& serialized)
+{
+  (void)serialized;
+  JanetStdRegex* regex = static_cast<JanetStdRegex*>(base);
+  init_std_regex(regex, pattern, argv, 0, argc);
+  return regex->re != nullptr;
+}
+
+// ECMAScript has no lookbehind, \b and ^ look at the byte before
+size_t
+std_engine_lookbehind(const JanetRegex* regex)
+{
+  (void)regex;
+  return 1;
+}
+
+// std::regex does not say, libstdc++ keeps about 100 to 200 bytes of NFA
+// per pattern byte, and more for counted repeats such as a{50}
+size_t
+std_engine_memory(const JanetRegex* regex)
+{
+  return sizeof(std::regex) + 128 * regex->pattern->size();
+}
+} // empty namespace
+
+const RegexEngine std_engine = {
+  "std",
+  std_engine_compile,
+  std_engine_release,
+  std_engine_captures,
+  std_engine_info,
+  std_engine_matcher,
+  std_engine_substitute,
+  nullptr, // no named groups
+  sizeof(JanetStdRegex),
+  std_engine_restore,
+  nullptr, // recompiled from the pattern
+  std_engine_lookbehind,
+  std_engine_memory,
+};
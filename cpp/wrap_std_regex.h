@@ -5,21 +5,15 @@
 #include <vector>
 #include <regex>
 
-struct JanetRegex
+#include "regex.h"
+
+// A regex compiled by C++ std::regex.
+struct JanetStdRegex : JanetRegex
 {
-  JanetGCObject             gc;
-  std::regex*               re      = nullptr;
-  std::string*              pattern = nullptr;
-  std::vector<std::string>* flags   = nullptr;
+  std::regex* re = nullptr;
 };
 
-extern JanetAbstractType regex_type;
-
-int set_gc(void* data, size_t len);
-int set_gcmark(void* data, size_t len);
-
-JanetRegex* new_abstract_regex(const char* input, const Janet* argv, int32_t flag_start, int32_t argc);
-
-JanetTable* extract_table_from_match(const std::string& input, const std::smatch& match);
+extern const RegexEngine std_engine;
 
-JanetArray* extract_array_from_iterator(const std::string& input, std::sregex_iterator& iter);
+// On failure `re` is null and `pattern` holds the error message.
+JanetStdRegex* new_abstract_std_regex(const char* input, const Janet* argv, int32_t flag_start, int32_t argc);